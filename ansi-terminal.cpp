@@ -0,0 +1,183 @@
+/* ansi-terminal.cpp
+
+Raw mode, frame assembly and key decoding for the ANSI backend.
+*/
+#include "ansi-terminal.h"
+#include "framebuffer.h"
+
+#include <ncurses.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+AnsiTerminal::AnsiTerminal(void)
+  : m_input(0), m_output(1), m_active(false), m_frame(ANSI_FRAME_BYTES), m_used(0),
+    m_lineDrawing(false), m_keyCount(0), m_keyNext(0), m_frames(0), m_writes(0), m_bytes(0)
+{
+  memset(&m_saved, 0, sizeof(m_saved));
+  for (int i = 0; i < ANSI_PAIRS; i++) {
+    m_pairColors[i][0] = -1;
+    m_pairColors[i][1] = -1;
+  }
+}
+
+AnsiTerminal::~AnsiTerminal()
+{
+  end();
+}
+
+bool AnsiTerminal::begin(int input, int output)
+{
+  if (m_active) return true;
+  m_input = input;
+  m_output = output;
+  if (tcgetattr(m_input, &m_saved) != 0) return false;
+
+  // no line editing, no echo, no signals, reads return whatever is there
+  struct termios raw = m_saved;
+  raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+  raw.c_oflag &= ~OPOST;
+  raw.c_cflag |= CS8;
+  raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+  raw.c_cc[VMIN] = 0;
+  raw.c_cc[VTIME] = 0;
+  if (tcsetattr(m_input, TCSAFLUSH, &raw) != 0) return false;
+  m_active = true;
+
+  // alternate screen, hidden cursor, cleared
+  m_used = 0;
+  putText("\x1b[?1049h\x1b[?25l");
+  clear();
+  return present();
+}
+
+void AnsiTerminal::end(void)
+{
+  if (!m_active) return;
+  m_used = 0;
+  m_lineDrawing = false;
+  putText("\x1b(B\x1b[0m\x1b[2J\x1b[?25h\x1b[?1049l");
+  present();
+  tcsetattr(m_input, TCSAFLUSH, &m_saved);
+  m_active = false;
+}
+
+void AnsiTerminal::definePair(short pair, short foreground, short background)
+{
+  if (pair <= 0 || pair >= ANSI_PAIRS) return;
+  m_pairColors[pair][0] = foreground;
+  m_pairColors[pair][1] = background;
+}
+
+void AnsiTerminal::append(const char* data, size_t length)
+{
+  if (m_used + length > m_frame.size()) m_frame.resize(2 * (m_used + length));
+  memcpy(&m_frame[m_used], data, length);
+  m_used += length;
+}
+
+void AnsiTerminal::appendNumber(unsigned int value)
+{
+  char digits[12];
+  int count = 0;
+  do {
+    digits[sizeof(digits) - 1 - count++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+  append(digits + sizeof(digits) - count, count);
+}
+
+void AnsiTerminal::putText(const char* text)
+{
+  append(text, strlen(text));
+}
+
+void AnsiTerminal::clear(void)
+{
+  putText("\x1b[0m\x1b[2J");
+}
+
+void AnsiTerminal::moveTo(unsigned int x, unsigned int y)
+{
+  append("\x1b[", 2);
+  appendNumber(y + 1);
+  append(";", 1);
+  appendNumber(x + 1);
+  append("H", 1);
+}
+
+void AnsiTerminal::setPair(short pair)
+{
+  if (pair <= 0 || pair >= ANSI_PAIRS || m_pairColors[pair][0] < 0) {
+    append("\x1b[0m", 4);
+    return;
+  }
+  append("\x1b[0;3", 5);
+  appendNumber(m_pairColors[pair][0]);
+  append(";4", 2);
+  appendNumber(m_pairColors[pair][1]);
+  append("m", 1);
+}
+
+void AnsiTerminal::putGlyph(uint32_t glyph)
+{
+  // line drawing characters are the same letters in the DEC special set
+  bool lineDrawing = (glyph & GLYPH_ACS) != 0;
+  if (lineDrawing != m_lineDrawing) {
+    append(lineDrawing ? "\x1b(0" : "\x1b(B", 3);
+    m_lineDrawing = lineDrawing;
+  }
+  char c = (char)(glyph & 0xFF);
+  append(&c, 1);
+}
+
+bool AnsiTerminal::present(void)
+{
+  // nothing changed, nothing to send
+  if (m_used == 0) return true;
+  if (m_lineDrawing) {
+    append("\x1b(B", 3);
+    m_lineDrawing = false;
+  }
+
+  size_t sent = 0;
+  while (sent < m_used) {
+    ssize_t written = write(m_output, &m_frame[sent], m_used - sent);
+    m_writes++;
+    if (written < 0) {
+      if (errno == EINTR || errno == EAGAIN) continue;
+      m_used = 0;
+      return false;
+    }
+    sent += written;
+  }
+  m_bytes += m_used;
+  m_frames++;
+  m_used = 0;
+  return true;
+}
+
+int AnsiTerminal::readKey(void)
+{
+  if (m_keyNext >= m_keyCount) {
+    ssize_t got = read(m_input, m_keys, sizeof(m_keys));
+    if (got <= 0) return ERR;
+    m_keyCount = got;
+    m_keyNext = 0;
+  }
+
+  int key = m_keys[m_keyNext++];
+  // arrow keys arrive as ESC [ A..D, or ESC O A..D in application mode
+  if (key == 0x1b && m_keyNext + 1 < m_keyCount) {
+    unsigned char introducer = m_keys[m_keyNext];
+    unsigned char final = m_keys[m_keyNext + 1];
+    if ((introducer == '[' || introducer == 'O') && final >= 'A' && final <= 'D') {
+      static const int arrows[4] = { KEY_UP, KEY_DOWN, KEY_RIGHT, KEY_LEFT };
+      m_keyNext += 2;
+      return arrows[final - 'A'];
+    }
+  }
+  // raw mode swallows ^C, treat it as quitting
+  if (key == 3) return 'q';
+  return key;
+}
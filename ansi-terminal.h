@@ -0,0 +1,79 @@
+/* ansi-terminal.h
+
+Raw ANSI terminal backend, the alternative to curses.  The terminal is put
+into raw mode with termios directly, and each frame is built as escape
+sequences in one preallocated buffer and sent with a single write(), so a
+frame reaches a remote player as one packet instead of however curses
+happened to split it.
+
+Keys are read straight from the input descriptor; arrow keys come back as
+curses' KEY_ codes so the game's input handling works with either backend.
+*/
+
+#ifndef _ANSI_TERMINAL_H_INCLUDED
+#define _ANSI_TERMINAL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <termios.h>
+#include <vector>
+
+/* Constants */
+const size_t ANSI_FRAME_BYTES = 64 * 1024;  // reserved up front, grown only if a frame is bigger
+const int ANSI_PAIRS = 8;
+
+class AnsiTerminal {
+  public:
+    AnsiTerminal(void);
+    ~AnsiTerminal();
+
+    // Raw mode, alternate screen, hidden cursor.  end() puts it all back.
+    bool begin(int input = 0, int output = 1);
+    void end(void);
+    bool active(void) const { return m_active; }
+
+    // like init_pair(), colors are the curses COLOR_ numbers
+    void definePair(short pair, short foreground, short background);
+
+    // Frame building, nothing is sent until present().
+    void clear(void);
+    void moveTo(unsigned int x, unsigned int y);
+    void setPair(short pair);
+    void putGlyph(uint32_t glyph);  // see framebuffer.h
+    void putText(const char* text);
+
+    // Send the frame in one write(), false if the terminal went away.  An
+    // empty frame sends nothing and is not counted.
+    bool present(void);
+
+    // Next key or ERR (-1) if none is waiting, never blocks.
+    int readKey(void);
+
+    uint64_t frames(void) const { return m_frames; }
+    uint64_t writes(void) const { return m_writes; }
+    uint64_t bytes(void) const { return m_bytes; }
+
+  private:
+    AnsiTerminal(const AnsiTerminal&);
+    AnsiTerminal& operator=(const AnsiTerminal&);
+
+    void append(const char* data, size_t length);
+    void appendNumber(unsigned int value);
+
+    int               m_input;
+    int               m_output;
+    bool              m_active;
+    struct termios    m_saved;
+    std::vector<char> m_frame;
+    size_t            m_used;
+    bool              m_lineDrawing;  // DEC special graphics selected
+    short             m_pairColors[ANSI_PAIRS][2];
+    unsigned char     m_keys[64];
+    size_t            m_keyCount;
+    size_t            m_keyNext;
+    uint64_t          m_frames;
+    uint64_t          m_writes;
+    uint64_t          m_bytes;
+};
+
+#endif /* _ANSI_TERMINAL_H_INCLUDED */
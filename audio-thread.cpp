@@ -0,0 +1,234 @@
+/* audio-thread.cpp
+
+Dedicated fluidsynth control thread.
+*/
+#include "audio-thread.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+/*-------------------\
+|---- STATISTICS ----|
+\-------------------*/
+LatencyStats::LatencyStats(void)
+  : m_count(0), m_total(0), m_max(0)
+{
+  for (int i = 0; i < BUCKETS; i++) m_buckets[i] = 0;
+}
+
+void LatencyStats::record(int64_t latency_us)
+{
+  if (latency_us < 0) latency_us = 0;
+  int bucket = (int)(latency_us / BUCKET_US);
+  m_buckets[bucket < BUCKETS ? bucket : BUCKETS - 1]++;
+  m_count++;
+  m_total += latency_us;
+  if (latency_us > m_max) m_max = latency_us;
+}
+
+// Upper edge of the bucket holding the given fraction of samples.
+int64_t LatencyStats::percentile(double fraction) const
+{
+  if (!m_count) return 0;
+  uint64_t target = (uint64_t)(fraction * m_count);
+  uint64_t seen = 0;
+  for (int i = 0; i < BUCKETS - 1; i++) {
+    seen += m_buckets[i];
+    if (seen > target) return (int64_t)(i + 1) * BUCKET_US < m_max ? (int64_t)(i + 1) * BUCKET_US : m_max;
+  }
+  return m_max;
+}
+
+/*-------------------\
+|---- NOTE OFFS -----|
+\-------------------*/
+NoteOffScheduler::NoteOffScheduler(void)
+{
+  m_expired.reserve(256);
+  reset(0);
+}
+
+void NoteOffScheduler::reset(int64_t now_us)
+{
+  m_wheel.reset(now_us);
+  for (int channel = 0; channel < 16; channel++) {
+    for (int key = 0; key < 128; key++) m_pendingOff[channel][key] = 0;
+  }
+  m_peakPending = 0;
+  m_scheduled = 0;
+  m_sent = 0;
+}
+
+void NoteOffScheduler::noteOn(int channel, int key, int64_t start_us, int64_t duration_us)
+{
+  channel &= 0x0F;
+  key &= 0x7F;
+  uint64_t& pending = m_pendingOff[channel][key];
+  if (pending) m_wheel.cancel(pending);
+  pending = 0;
+  if (duration_us <= 0) return;
+
+  pending = m_wheel.schedule(start_us + duration_us, (uint32_t)channel << 7 | (uint32_t)key);
+  m_scheduled++;
+  if (m_wheel.pending() > m_peakPending) m_peakPending = m_wheel.pending();
+}
+
+size_t NoteOffScheduler::advance(int64_t now_us, fluid_synth_t* synth)
+{
+  m_expired.clear();
+  m_wheel.advance(now_us, m_expired);
+  size_t sent = 0;
+  for (size_t i = 0; i < m_expired.size(); i++) {
+    int channel = (m_expired[i] >> 7) & 0x0F;
+    int key = m_expired[i] & 0x7F;
+    m_pendingOff[channel][key] = 0;
+    fluid_synth_noteoff(synth, channel, key);
+    sent++;
+  }
+  m_sent += sent;
+  return sent;
+}
+
+int64_t VoiceStats::sample(fluid_synth_t* synth, int64_t now_us)
+{
+  if (now_us < m_next_us) return m_next_us;
+  int voices = fluid_synth_get_active_voice_count(synth);
+  m_samples++;
+  m_total += voices;
+  if (voices > m_peak) m_peak = voices;
+  m_next_us = now_us + VOICE_SAMPLE_US;
+  return m_next_us;
+}
+
+int64_t microsSince(const struct timespec& epoch)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (t.tv_sec - epoch.tv_sec) * 1000000LL + (t.tv_nsec - epoch.tv_nsec) / 1000;
+}
+
+/*-------------------\
+|--- AUDIO THREAD ---|
+\-------------------*/
+AudioThread::AudioThread(void)
+  : m_synth(NULL), m_backing(NULL), m_sleeping(false), m_stopping(false), m_dropped(0)
+{
+  m_wake[0] = m_wake[1] = -1;
+}
+
+AudioThread::~AudioThread()
+{
+  stop();
+}
+
+bool AudioThread::start(fluid_synth_t* synth, const struct timespec& epoch)
+{
+  if (running() || !synth) return false;
+  if (pipe(m_wake) != 0) return false;
+  // a full pipe already means "wake up", so writes must never block
+  fcntl(m_wake[1], F_SETFL, fcntl(m_wake[1], F_GETFL) | O_NONBLOCK);
+  fcntl(m_wake[0], F_SETFL, fcntl(m_wake[0], F_GETFL) | O_NONBLOCK);
+
+  m_synth = synth;
+  m_epoch = epoch;
+  m_stopping = false;
+  m_thread = std::thread(&AudioThread::run, this);
+  return true;
+}
+
+void AudioThread::stop(void)
+{
+  if (!running()) return;
+  m_stopping = true;
+  char wake = 0;
+  if (write(m_wake[1], &wake, 1) < 0) { }
+  m_thread.join();
+  close(m_wake[0]);
+  close(m_wake[1]);
+  m_wake[0] = m_wake[1] = -1;
+}
+
+bool AudioThread::send(const AudioCommand& command)
+{
+  if (!m_queue.push(command)) {
+    m_dropped++;
+    return false;
+  }
+  // only pay for the syscall when the consumer is asleep
+  if (m_sleeping.exchange(false)) {
+    char wake = 0;
+    if (write(m_wake[1], &wake, 1) < 0) { }
+  }
+  return true;
+}
+
+bool AudioThread::noteOn(int channel, int key, int velocity, int64_t time_us, int64_t duration_us)
+{
+  AudioCommand command = { time_us, AUDIO_NOTE_ON, (uint8_t)channel, (uint8_t)key, (uint8_t)velocity, (uint32_t)duration_us };
+  return send(command);
+}
+
+bool AudioThread::noteOff(int channel, int key, int64_t time_us)
+{
+  AudioCommand command = { time_us, AUDIO_NOTE_OFF, (uint8_t)channel, (uint8_t)key, 0, 0 };
+  return send(command);
+}
+
+bool AudioThread::programChange(int channel, int program, int64_t time_us)
+{
+  AudioCommand command = { time_us, AUDIO_PROGRAM_CHANGE, (uint8_t)channel, (uint8_t)program, 0, 0 };
+  return send(command);
+}
+
+void AudioThread::apply(const AudioCommand& command)
+{
+  switch (command.type) {
+  case AUDIO_NOTE_ON: {
+    fluid_synth_noteon(m_synth, command.channel, command.data1, command.data2);
+    int64_t now_us = microsSince(m_epoch);
+    m_noteOnLatency.record(now_us - command.time_us);
+    m_noteOffs.noteOn(command.channel, command.data1, now_us, command.duration_us);
+    break;
+  }
+  case AUDIO_NOTE_OFF:
+    fluid_synth_noteoff(m_synth, command.channel, command.data1);
+    break;
+  case AUDIO_PROGRAM_CHANGE:
+    fluid_synth_program_change(m_synth, command.channel, command.data1);
+    break;
+  }
+}
+
+void AudioThread::run(void)
+{
+  AudioCommand command;
+  char drain[64];
+  m_noteOffs.reset(microsSince(m_epoch));
+  while (!m_stopping) {
+    while (m_queue.pop(command)) apply(command);
+
+    // note offs and voice samples due by now, then sleep until the next one
+    int64_t now_us = microsSince(m_epoch);
+    m_noteOffs.advance(now_us, m_synth);
+    int64_t deadline = m_voices.sample(m_synth, now_us);
+    int64_t noteOff = m_noteOffs.nextDeadline();
+    if (noteOff >= 0 && noteOff < deadline) deadline = noteOff;
+    int64_t backing = m_backing ? m_backing->pump(now_us) : -1;
+    if (backing >= 0 && backing < deadline) deadline = backing;
+
+    // announce we are going to sleep, then look once more so a command
+    // pushed in between is not left waiting for the next one
+    m_sleeping = true;
+    if (!m_queue.empty() || m_stopping) {
+      m_sleeping = false;
+      continue;
+    }
+    struct pollfd wake = { m_wake[0], POLLIN, 0 };
+    int64_t remaining = deadline - microsSince(m_epoch);
+    poll(&wake, 1, remaining > 0 ? (int)((remaining + 999) / 1000) : 0);
+    while (read(m_wake[0], drain, sizeof(drain)) > 0) { }
+    m_sleeping = false;
+  }
+  while (m_queue.pop(command)) apply(command);
+}
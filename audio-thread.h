@@ -0,0 +1,167 @@
+/* audio-thread.h
+
+Audio control thread.  The game never calls into fluidsynth from its input
+or render loop; it drops time-stamped note on, note off and program change
+commands into a lock-free single-producer single-consumer queue, and a
+dedicated thread applies them to the synth.  The producer side never blocks
+and never allocates, so a slow synth call cannot hold up input and a slow
+frame cannot hold up audio.
+
+The consumer sleeps in poll() on a pipe while the queue is empty; producers
+only write to the pipe when the consumer is actually asleep.  It also sends
+the note off for every note with a length, from a timer wheel, keeps the
+backing track's sequencer fed, and samples how many voices are sounding.
+*/
+
+#ifndef _AUDIO_THREAD_H_INCLUDED
+#define _AUDIO_THREAD_H_INCLUDED
+
+#include "spsc-queue.h"
+#include "timer-wheel.h"
+#include "backing-track.h"
+
+#include <fluidsynth.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* Constants */
+enum AudioCommandType {
+  AUDIO_NOTE_ON,
+  AUDIO_NOTE_OFF,
+  AUDIO_PROGRAM_CHANGE
+};
+
+const size_t AUDIO_QUEUE_SIZE = 1024;
+const int64_t VOICE_SAMPLE_US = 100000;  // how often the active voice count is sampled
+
+/* Structs */
+struct AudioCommand {
+  int64_t time_us;   // when the command was issued, on the game clock
+  uint8_t type;      // AudioCommandType
+  uint8_t channel;
+  uint8_t data1;     // key or program
+  uint8_t data2;     // velocity
+  uint32_t duration_us;  // note on: when to send the note off, 0 for never
+};
+
+// Latency histogram in 10 microsecond buckets, recording never allocates.
+class LatencyStats {
+  public:
+    LatencyStats(void);
+    void record(int64_t latency_us);
+    uint64_t count(void) const { return m_count; }
+    double mean(void) const { return m_count ? (double)m_total / m_count : 0; }
+    int64_t max(void) const { return m_max; }
+    int64_t percentile(double fraction) const;
+
+  private:
+    static const int BUCKET_US = 10;
+    static const int BUCKETS = 1000;  // the last bucket holds everything >= 10 ms
+
+    uint64_t m_buckets[BUCKETS];
+    uint64_t m_count;
+    int64_t  m_total;
+    int64_t  m_max;
+};
+
+// Note offs for notes played with a known length, kept in a timer wheel.  A
+// note off is cancelled if the same key is struck again first, the newer
+// note's own note off ends it.
+class NoteOffScheduler {
+  public:
+    NoteOffScheduler(void);
+    void reset(int64_t now_us);
+
+    void noteOn(int channel, int key, int64_t start_us, int64_t duration_us);
+
+    // Send every note off due by now_us to synth, returns how many were.
+    size_t advance(int64_t now_us, fluid_synth_t* synth);
+
+    int64_t nextDeadline(void) const { return m_wheel.nextDeadline(); }
+    size_t pending(void) const { return m_wheel.pending(); }
+    size_t peakPending(void) const { return m_peakPending; }
+    uint64_t scheduled(void) const { return m_scheduled; }
+    uint64_t sent(void) const { return m_sent; }
+
+  private:
+    TimerWheel            m_wheel;
+    std::vector<uint32_t> m_expired;
+    uint64_t              m_pendingOff[16][128];  // timer id, 0 if none
+    size_t                m_peakPending;
+    uint64_t              m_scheduled;
+    uint64_t              m_sent;
+};
+
+// Active synth voices sampled over a song.
+class VoiceStats {
+  public:
+    VoiceStats(void) : m_samples(0), m_total(0), m_peak(0), m_next_us(0) { }
+
+    // Sample the synth if VOICE_SAMPLE_US has passed since the last sample,
+    // returns when the next one is due.
+    int64_t sample(fluid_synth_t* synth, int64_t now_us);
+
+    uint64_t samples(void) const { return m_samples; }
+    double mean(void) const { return m_samples ? (double)m_total / m_samples : 0; }
+    int peak(void) const { return m_peak; }
+
+  private:
+    uint64_t m_samples;
+    uint64_t m_total;
+    int      m_peak;
+    int64_t  m_next_us;
+};
+
+// Microseconds on CLOCK_MONOTONIC since epoch.
+int64_t microsSince(const struct timespec& epoch);
+
+class AudioThread {
+  public:
+    AudioThread(void);
+    ~AudioThread();
+
+    // Times passed to the senders are microseconds since epoch.
+    bool start(fluid_synth_t* synth, const struct timespec& epoch);
+
+    // Keep backing's sequencer topped up from this thread, set before start().
+    void setBacking(BackingTrack* backing) { m_backing = backing; }
+    void stop(void);
+    bool running(void) const { return m_thread.joinable(); }
+
+    // Producer side, call from one thread only.  Returns false if the queue
+    // was full and the command was dropped.
+    // A note on with a duration is ended by a note off that much later.
+    bool noteOn(int channel, int key, int velocity, int64_t time_us, int64_t duration_us = 0);
+    bool noteOff(int channel, int key, int64_t time_us);
+    bool programChange(int channel, int program, int64_t time_us);
+
+    // Issue time to fluid_synth_noteon() returning.  Only read it after stop().
+    const LatencyStats& noteOnLatency(void) const { return m_noteOnLatency; }
+    const NoteOffScheduler& noteOffs(void) const { return m_noteOffs; }
+    const VoiceStats& voices(void) const { return m_voices; }
+    uint64_t dropped(void) const { return m_dropped; }
+
+  private:
+    bool send(const AudioCommand& command);
+    void run(void);
+    void apply(const AudioCommand& command);
+
+    SpscQueue<AudioCommand, AUDIO_QUEUE_SIZE> m_queue;
+    fluid_synth_t*    m_synth;
+    BackingTrack*     m_backing;
+    struct timespec   m_epoch;
+    int               m_wake[2];  // pipe, read end first
+    std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_stopping;
+    std::thread       m_thread;
+    LatencyStats      m_noteOnLatency;
+    NoteOffScheduler  m_noteOffs;
+    VoiceStats        m_voices;
+    uint64_t          m_dropped;
+};
+
+#endif /* _AUDIO_THREAD_H_INCLUDED */
@@ -0,0 +1,160 @@
+/* backing-track.cpp
+
+Backing track decoding and sequencer scheduling.
+*/
+#include "backing-track.h"
+#include "scroll-scheduler.h"
+#include "smf-decoder.h"
+#include "tempo-map.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+BackingTrack::BackingTrack(void)
+  : m_cursor(0), m_sequencer(NULL), m_event(NULL), m_startTick(0), m_start_us(0),
+    m_lookahead_us(0), m_nextPump_us(0), m_sent(0), m_batches(0)
+{
+}
+
+BackingTrack::~BackingTrack()
+{
+  stop();
+}
+
+bool BackingTrack::load(const std::string& bytes, uint16_t playerChannels, int delayRows, int rowsPerQuarter)
+{
+  SmfLayout layout;
+  if (!readSmfLayout((const unsigned char*)bytes.data(), bytes.size(), layout)) return false;
+  m_events.clear();
+  m_cursor = 0;
+
+  // merge the tracks by (tick, track) so tempo changes arrive in order
+  size_t tracks = layout.tracks.size();
+  std::vector<SmfTrackDecoder> decoders(tracks);
+  std::vector<SmfEvent> heads(tracks);
+  typedef std::pair<int64_t, size_t> HeapEntry;
+  std::vector<HeapEntry> heap;
+  for (size_t t = 0; t < tracks; t++) {
+    decoders[t].reset(layout.tracks[t]);
+    if (decoders[t].next(heads[t])) heap.push_back(HeapEntry(heads[t].tick, t));
+  }
+  std::make_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+
+  TempoMap tempoMap(layout.division);
+  std::vector<int64_t> ticks;
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    size_t track = heap.back().second;
+    heap.pop_back();
+    const SmfEvent& event = heads[track];
+
+    if (isSmfTempo(event)) {
+      tempoMap.addTempo(event.tick, smfTempo(event));
+    } else if (event.status >= 0x80 && event.status < 0xF0) {
+      bool note = isSmfNoteOn(event) || isSmfNoteOff(event);
+      if (!note || !(playerChannels & (1 << (event.status & 0x0F)))) {
+        BackingEvent backing;
+        backing.time_us = 0;
+        backing.status = event.status;
+        backing.data1 = event.length > 0 ? event.data[0] : 0;
+        backing.data2 = event.length > 1 ? event.data[1] : 0;
+        m_events.push_back(backing);
+        ticks.push_back(event.tick);
+      }
+    }
+
+    if (decoders[track].next(heads[track])) {
+      heap.push_back(HeapEntry(heads[track].tick, track));
+      std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    }
+  }
+
+  // the musical position delayRows rows later, exact between ticks.  Only
+  // timed now the tempo map is complete, a tempo change inside the delay
+  // comes after the event itself.
+  for (size_t i = 0; i < m_events.size(); i++) m_events[i].time_us = delayedTickTime(tempoMap, ticks[i], delayRows, rowsPerQuarter);
+  return true;
+}
+
+bool BackingTrack::start(fluid_synth_t* synth, int64_t now_us, int64_t lookahead_us)
+{
+  stop();
+  // 0: the sequencer follows the synth's sample clock, not the system timer
+  m_sequencer = new_fluid_sequencer2(0);
+  if (!m_sequencer) return false;
+  fluid_seq_id_t synthId = fluid_sequencer_register_fluidsynth(m_sequencer, synth);
+  m_event = new_fluid_event();
+  fluid_event_set_source(m_event, -1);
+  fluid_event_set_dest(m_event, synthId);
+
+  m_startTick = fluid_sequencer_get_tick(m_sequencer);
+  m_start_us = now_us;
+  m_lookahead_us = lookahead_us > 0 ? lookahead_us : 1000;
+  m_nextPump_us = now_us;
+  m_cursor = 0;
+  m_sent = 0;
+  m_batches = 0;
+  return true;
+}
+
+void BackingTrack::stop(void)
+{
+  if (m_event) delete_fluid_event(m_event);
+  if (m_sequencer) delete_fluid_sequencer(m_sequencer);
+  m_event = NULL;
+  m_sequencer = NULL;
+}
+
+void BackingTrack::send(const BackingEvent& event, unsigned int tick)
+{
+  int channel = event.status & 0x0F;
+  switch (event.status & 0xF0) {
+  case 0x80:
+    fluid_event_noteoff(m_event, channel, event.data1);
+    break;
+  case 0x90:
+    if (event.data2) fluid_event_noteon(m_event, channel, event.data1, event.data2);
+    else fluid_event_noteoff(m_event, channel, event.data1);
+    break;
+  case 0xA0:
+    fluid_event_key_pressure(m_event, channel, event.data1, event.data2);
+    break;
+  case 0xB0:
+    fluid_event_control_change(m_event, channel, event.data1, event.data2);
+    break;
+  case 0xC0:
+    fluid_event_program_change(m_event, channel, event.data1);
+    break;
+  case 0xD0:
+    fluid_event_channel_pressure(m_event, channel, event.data1);
+    break;
+  case 0xE0:
+    fluid_event_pitch_bend(m_event, channel, event.data2 << 7 | event.data1);
+    break;
+  default:
+    return;
+  }
+  fluid_sequencer_send_at(m_sequencer, m_event, tick, 1);
+  m_sent++;
+}
+
+int64_t BackingTrack::pump(int64_t now_us)
+{
+  if (!m_sequencer || m_cursor >= m_events.size()) return -1;
+  if (now_us < m_nextPump_us) return m_nextPump_us;
+
+  // sequencer ticks are milliseconds; anything already late goes out now
+  unsigned int nowTick = fluid_sequencer_get_tick(m_sequencer);
+  int64_t horizon = now_us + m_lookahead_us;
+  size_t first = m_cursor;
+  while (m_cursor < m_events.size() && m_events[m_cursor].time_us < horizon) {
+    const BackingEvent& event = m_events[m_cursor++];
+    int64_t tick = m_startTick + (event.time_us - m_start_us) / 1000;
+    send(event, tick > (int64_t)nowTick ? (unsigned int)tick : nowTick);
+  }
+  if (m_cursor > first) m_batches++;
+
+  m_nextPump_us = now_us + m_lookahead_us / 2;
+  return m_cursor < m_events.size() ? m_nextPump_us : -1;
+}
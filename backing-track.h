@@ -0,0 +1,74 @@
+/* backing-track.h
+
+The rest of the band.  Every channel event of the song that is not a note in
+the player's part (other channels, the drums, controllers, patch changes,
+pitch bends) is decoded once at load time and handed to a fluidsynth
+sequencer a lookahead window at a time.  The sequencer is clocked by the
+synth's own sample counter, so the backing plays sample accurately no matter
+how often the game loop or the audio thread wakes up, and each wakeup sends
+a whole window of events in one batch.
+
+Events are delayed by the rows a note takes to fall down the board, so the
+backing lines up with the notes the player is hitting.
+*/
+
+#ifndef _BACKING_TRACK_H_INCLUDED
+#define _BACKING_TRACK_H_INCLUDED
+
+#include <fluidsynth.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Structs */
+struct BackingEvent {
+  int64_t time_us;  // on the game clock, board delay included
+  uint8_t status;
+  uint8_t data1;
+  uint8_t data2;
+};
+
+class BackingTrack {
+  public:
+    BackingTrack(void);
+    ~BackingTrack();
+
+    // Decode the song, keeping every channel event except the notes on the
+    // channels set in playerChannels (bit n for channel n).  Events are
+    // delayed by delayRows board rows of rowsPerQuarter to a quarter note.
+    bool load(const std::string& bytes, uint16_t playerChannels, int delayRows, int rowsPerQuarter);
+    size_t size(void) const { return m_events.size(); }
+    const std::vector<BackingEvent>& events(void) const { return m_events; }
+
+    // Start a sequencer on synth, with game time now_us.
+    bool start(fluid_synth_t* synth, int64_t now_us, int64_t lookahead_us);
+    void stop(void);
+    bool running(void) const { return m_sequencer != NULL; }
+
+    // Schedule everything due before now_us + lookahead.  Returns when it
+    // next needs calling: half a window later, or -1 once the song is done.
+    int64_t pump(int64_t now_us);
+
+    uint64_t sent(void) const { return m_sent; }
+    uint64_t batches(void) const { return m_batches; }
+
+  private:
+    BackingTrack(const BackingTrack&);
+    BackingTrack& operator=(const BackingTrack&);
+
+    void send(const BackingEvent& event, unsigned int tick);
+
+    std::vector<BackingEvent> m_events;
+    size_t             m_cursor;
+    fluid_sequencer_t* m_sequencer;
+    fluid_event_t*     m_event;
+    unsigned int       m_startTick;  // sequencer tick (ms) at game time m_start_us
+    int64_t            m_start_us;
+    int64_t            m_lookahead_us;
+    int64_t            m_nextPump_us;
+    uint64_t           m_sent;
+    uint64_t           m_batches;
+};
+
+#endif /* _BACKING_TRACK_H_INCLUDED */
@@ -0,0 +1,67 @@
+/* board.h
+
+The falling-note board.  Rows live in a ring buffer: scrolling the board down
+a row moves the head index and clears the one row that wraps around to the
+top, instead of copying every cell of every lane.  The board only says where
+notes are drawn.  Lanes are assigned when the chart loads (lane-map.h), hits
+are judged on note times (judge.h), and a lane's one note per row is decided
+on the chart, so nothing asks the board about more than a single cell.
+
+Lane count and height are template parameters, so a 5 or 6 lane layout is a
+different instantiation with the same code and no runtime cost.
+
+Row 0 is the finish line, row Height - 1 the top where notes appear.
+*/
+
+#ifndef _BOARD_H_INCLUDED
+#define _BOARD_H_INCLUDED
+
+template <unsigned int Lanes, unsigned int Height>
+class Board {
+  static_assert(Lanes > 0, "a board needs a lane");
+
+  public:
+    static const unsigned int LANES = Lanes;
+    static const unsigned int HEIGHT = Height;
+
+    Board(void) { clear(); }
+
+    void clear(void)
+    {
+      for (unsigned int r = 0; r < Height; r++) clearRow(r);
+      m_head = 0;
+    }
+
+    // Move every note down a row, the finish line row drops off the bottom
+    // and comes back empty at the top.
+    void scrollDown(void)
+    {
+      unsigned int bottom = m_head;
+      m_head = m_head + 1 < Height ? m_head + 1 : 0;
+      clearRow(bottom);
+    }
+
+    int note(unsigned int lane, unsigned int row) const { return m_notes[slot(row)][lane]; }
+    bool occupied(unsigned int lane, unsigned int row) const { return note(lane, row) != 0; }
+
+    void set(unsigned int lane, unsigned int row, int note) { m_notes[slot(row)][lane] = note; }
+    void spawn(unsigned int lane, int note) { set(lane, Height - 1, note); }
+
+  private:
+    // physical row of board row row
+    unsigned int slot(unsigned int row) const
+    {
+      unsigned int s = m_head + row;
+      return s < Height ? s : s - Height;
+    }
+
+    void clearRow(unsigned int s)
+    {
+      for (unsigned int l = 0; l < Lanes; l++) m_notes[s][l] = 0;
+    }
+
+    int          m_notes[Height][Lanes];  // a row's lanes are contiguous
+    unsigned int m_head;                  // physical row of the finish line
+};
+
+#endif /* _BOARD_H_INCLUDED */
@@ -0,0 +1,115 @@
+/* calibration.cpp
+
+Tap statistics and the per machine calibration file.
+*/
+#include "calibration.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+// median of values, which gets reordered
+static int64_t median(std::vector<int64_t>& values)
+{
+  size_t middle = values.size() / 2;
+  std::nth_element(values.begin(), values.begin() + middle, values.end());
+  int64_t upper = values[middle];
+  if (values.size() % 2) return upper;
+  int64_t lower = *std::max_element(values.begin(), values.begin() + middle);
+  return (lower + upper) / 2;
+}
+
+bool estimateTapOffset(const std::vector<int64_t>& offsets, TapEstimate& estimate, int minTaps)
+{
+  estimate.offset_us = 0;
+  estimate.spread_us = 0;
+  estimate.used = 0;
+  estimate.rejected = (int)offsets.size();
+  if (offsets.empty()) return false;
+
+  std::vector<int64_t> scratch(offsets);
+  int64_t center = median(scratch);
+  for (size_t i = 0; i < offsets.size(); i++) scratch[i] = llabs(offsets[i] - center);
+  // a player who taps perfectly evenly must not reject every tap but one
+  int64_t deviation = median(scratch);
+  if (deviation < 1000) deviation = 1000;
+  double limit = 3 * 1.4826 * deviation;
+
+  double sum = 0, squares = 0;
+  int used = 0;
+  for (size_t i = 0; i < offsets.size(); i++) {
+    if (fabs((double)(offsets[i] - center)) > limit) continue;
+    sum += offsets[i];
+    squares += (double)offsets[i] * offsets[i];
+    used++;
+  }
+  estimate.used = used;
+  estimate.rejected = (int)offsets.size() - used;
+  if (used < minTaps || used == 0) return false;
+
+  double mean = sum / used;
+  double variance = squares / used - mean * mean;
+  estimate.offset_us = (int64_t)llround(mean);
+  estimate.spread_us = variance > 0 ? sqrt(variance) : 0;
+  return true;
+}
+
+// mkdir that is happy if the directory is already there
+static bool makeDirectory(const std::string& path)
+{
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+std::string calibrationPath(void)
+{
+  std::string directory;
+  const char* xdg = getenv("XDG_CONFIG_HOME");
+  const char* home = getenv("HOME");
+  if (xdg && *xdg) {
+    directory = xdg;
+  } else if (home && *home) {
+    directory = std::string(home) + "/.config";
+  } else {
+    return "";
+  }
+
+  directory += "/terminal-hero";
+  if (!makeDirectory(directory.substr(0, directory.rfind('/'))) || !makeDirectory(directory)) return "";
+
+  // latency belongs to the machine, keep one file per host in a shared home
+  char host[256];
+  if (gethostname(host, sizeof(host)) != 0 || !host[0]) strcpy(host, "localhost");
+  host[sizeof(host) - 1] = '\0';
+  for (char* c = host; *c; c++) if (*c == '/') *c = '_';
+  return directory + "/calibration-" + host;
+}
+
+bool loadCalibration(Calibration& calibration)
+{
+  std::string path = calibrationPath();
+  FILE* input = path.empty() ? NULL : fopen(path.c_str(), "r");
+  if (!input) return false;
+
+  long long inputOffset, audioOffset;
+  bool ok = fscanf(input, "input_us %lld audio_us %lld", &inputOffset, &audioOffset) == 2;
+  fclose(input);
+  if (!ok) return false;
+  calibration.input_us = inputOffset;
+  calibration.audio_us = audioOffset;
+  return true;
+}
+
+bool saveCalibration(const Calibration& calibration)
+{
+  std::string path = calibrationPath();
+  FILE* output = path.empty() ? NULL : fopen(path.c_str(), "w");
+  if (!output) return false;
+
+  fprintf(output, "input_us %lld\naudio_us %lld\n", (long long)calibration.input_us, (long long)calibration.audio_us);
+  return fclose(output) == 0;
+}
@@ -0,0 +1,49 @@
+/* calibration.h
+
+Latency calibration.  Two offsets sit between the game clock and the player:
+the input offset, from a key being pressed (or a frame being drawn) to the
+game reading it, and the audio offset, from a note being handed to the synth
+to it coming out of the speakers.  Both are estimated from the player tapping
+along to a metronome, once to clicks they can only see and once to clicks
+they can only hear, and are saved per machine.
+
+Calibration file: $XDG_CONFIG_HOME/terminal-hero/calibration-<hostname>,
+else ~/.config/terminal-hero/calibration-<hostname>
+*/
+
+#ifndef _CALIBRATION_H_INCLUDED
+#define _CALIBRATION_H_INCLUDED
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Structs */
+struct Calibration {
+  int64_t input_us;  // key press or frame to the game seeing it
+  int64_t audio_us;  // synth call to the sound being heard
+};
+
+// Mean offset of the taps that survive outlier rejection, and their spread.
+struct TapEstimate {
+  int64_t offset_us;
+  double  spread_us;  // standard deviation of the kept taps
+  int     used;
+  int     rejected;
+};
+
+/* Function References */
+// Reject taps further than three robust standard deviations (1.4826 * median
+// absolute deviation) from the median tap and average the rest.  Fails when
+// fewer than minTaps taps are left.
+bool estimateTapOffset(const std::vector<int64_t>& offsets, TapEstimate& estimate, int minTaps = 6);
+
+// Full path of this machine's calibration file, creating its directory if
+// needed.  Empty if there is nowhere to put it.
+std::string calibrationPath(void);
+
+// A missing or unreadable file leaves calibration untouched.
+bool loadCalibration(Calibration& calibration);
+bool saveCalibration(const Calibration& calibration);
+
+#endif /* _CALIBRATION_H_INCLUDED */
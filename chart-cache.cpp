@@ -0,0 +1,137 @@
+/* chart-cache.cpp
+
+On-disk cache of compiled note charts.
+*/
+#include "chart-cache.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <sstream>
+
+using namespace smf;
+
+uint64_t hashBytes(const void* data, size_t length)
+{
+  const unsigned char* bytes = (const unsigned char*)data;
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool readFileBytes(const std::string& filename, std::string& bytes)
+{
+  FILE* input = fopen(filename.c_str(), "rb");
+  if (!input) return false;
+
+  bytes.clear();
+  char buffer[65536];
+  size_t got;
+  while ((got = fread(buffer, 1, sizeof(buffer), input)) > 0) bytes.append(buffer, got);
+  bool ok = !ferror(input);
+  fclose(input);
+  return ok;
+}
+
+// mkdir that is happy if the directory is already there
+static bool makeDirectory(const std::string& path)
+{
+  return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+}
+
+std::string cacheDirectory(void)
+{
+  std::string directory;
+  const char* xdg = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdg && *xdg) {
+    directory = xdg;
+  } else if (home && *home) {
+    directory = std::string(home) + "/.cache";
+  } else {
+    return "";
+  }
+
+  directory += "/terminal-hero";
+  if (!makeDirectory(directory.substr(0, directory.rfind('/'))) || !makeDirectory(directory)) return "";
+  return directory;
+}
+
+std::string chartCachePath(uint64_t hash)
+{
+  std::string directory = cacheDirectory();
+  if (directory.empty()) return "";
+
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.chart", (unsigned long long)hash);
+  return directory + name;
+}
+
+bool mapCachedChart(uint64_t hash, NoteChart& chart)
+{
+  std::string cachePath = chartCachePath(hash);
+  return !cachePath.empty() && chart.mapFile(cachePath, hash);
+}
+
+bool cacheChart(const NoteChart& chart)
+{
+  std::string cachePath = chartCachePath(chart.sourceHash());
+  return !cachePath.empty() && chart.writeFile(cachePath);
+}
+
+bool compileChartFromBytes(const std::string& bytes, uint64_t hash,
+                           MergeJoinMidiFile& midifile, NoteChart& chart)
+{
+  std::istringstream stream(bytes);
+  if (!midifile.read(stream)) return false;
+  // pair notes within each track in file order, as the event store does,
+  // the links survive the join
+  midifile.linkNotePairs();
+  midifile.doTimeAnalysis();
+  midifile.joinTracks();
+
+  chart.setSourceHash(hash);
+  compileNoteChart(midifile, chart);
+  return true;
+}
+
+bool compileChartFromEvents(const std::string& bytes, uint64_t hash,
+                            EventStore& events, NoteChart& chart,
+                            int threads, LoadTimings* timings)
+{
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (!events.read((const unsigned char*)bytes.data(), bytes.size(), threads)) return false;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (timings) timings->decode_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+  chart.setSourceHash(hash);
+  compileNoteChart(events, chart, threads, timings);
+  return true;
+}
+
+bool loadNoteChart(const std::string& filename, MergeJoinMidiFile& midifile,
+                   NoteChart& chart, bool useCache, bool& cacheHit)
+{
+  cacheHit = false;
+
+  std::string bytes;
+  if (!readFileBytes(filename, bytes)) return false;
+
+  uint64_t hash = hashBytes(bytes.data(), bytes.size());
+  if (useCache && mapCachedChart(hash, chart)) {
+    cacheHit = true;
+    return true;
+  }
+
+  // cold start, run the full MidiFile pipeline
+  if (!compileChartFromBytes(bytes, hash, midifile, chart)) return false;
+  midifile.setFilename(filename);
+  if (useCache) cacheChart(chart);
+  return true;
+}
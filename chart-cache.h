@@ -0,0 +1,61 @@
+/* chart-cache.h
+
+Compiled charts are cached on disk, keyed by a hash of the MIDI file bytes, so
+a warm start maps the chart straight into memory and never touches the
+smf::MidiFile pipeline.
+
+Cache directory: $XDG_CACHE_HOME/terminal-hero, else ~/.cache/terminal-hero
+*/
+
+#ifndef _CHART_CACHE_H_INCLUDED
+#define _CHART_CACHE_H_INCLUDED
+
+#include "MidiFile.h"
+#include "midi-join.h"
+#include "note-chart.h"
+#include "event-store.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/* Function References */
+// 64 bit FNV-1a
+uint64_t hashBytes(const void* data, size_t length);
+
+bool readFileBytes(const std::string& filename, std::string& bytes);
+
+// The cache directory, created if needed.  Empty if there is nowhere to
+// put a cache.
+std::string cacheDirectory(void);
+
+// Full path of the cached chart for a source hash, creating the cache
+// directory if needed.  Empty if there is nowhere to put a cache.
+std::string chartCachePath(uint64_t hash);
+
+// Map the cached chart for a source hash.  False on a miss or a stale file.
+bool mapCachedChart(uint64_t hash, NoteChart& chart);
+
+// Write chart to the cache under its source hash.
+bool cacheChart(const NoteChart& chart);
+
+// Run the MidiFile pipeline (read, linkNotePairs, doTimeAnalysis,
+// joinTracks) on the file bytes and compile the chart from it.
+bool compileChartFromBytes(const std::string& bytes, uint64_t hash,
+                           MergeJoinMidiFile& midifile, NoteChart& chart);
+
+// Decode the file bytes into the compact event store and compile the chart
+// from it, on up to threads threads.  Much lighter than the MidiFile
+// pipeline.  timings, if given, receives the time spent in each phase.
+bool compileChartFromEvents(const std::string& bytes, uint64_t hash,
+                            EventStore& events, NoteChart& chart,
+                            int threads = 1, LoadTimings* timings = NULL);
+
+// Fill chart for the MIDI file at filename.  Uses the cache when useCache is
+// set, otherwise (or on a miss) compiles the chart through midifile,
+// refreshing the cache.  Returns false if the file could not be read;
+// cacheHit reports whether the MidiFile pipeline was skipped.
+bool loadNoteChart(const std::string& filename, MergeJoinMidiFile& midifile,
+                   NoteChart& chart, bool useCache, bool& cacheHit);
+
+#endif /* _CHART_CACHE_H_INCLUDED */
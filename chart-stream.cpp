@@ -0,0 +1,193 @@
+/* chart-stream.cpp
+
+Background decoding of MIDI files into note chart batches.
+*/
+#include "chart-stream.h"
+#include "smf-decoder.h"
+#include "tempo-map.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+// flush a batch after this many notes or this much song time
+static const size_t  BATCH_NOTES = 1024;
+static const int64_t BATCH_US = 250000;
+
+ChartStream::ChartStream(void)
+  : m_lookahead_us(0), m_division(120), m_capacity(0),
+    m_ready(false), m_done(false), m_failed(false), m_stopping(false)
+{
+}
+
+ChartStream::~ChartStream()
+{
+  stop();
+}
+
+void ChartStream::stop(void)
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_changed.notify_all();
+  if (m_thread.joinable()) m_thread.join();
+}
+
+bool ChartStream::start(const std::string& bytes, int64_t lookahead_us, size_t queueBatches)
+{
+  SmfLayout layout;
+  if (!readSmfLayout((const unsigned char*)bytes.data(), bytes.size(), layout)) return false;
+
+  m_bytes = bytes;
+  m_division = layout.division;
+  m_lookahead_us = lookahead_us;
+  m_capacity = queueBatches ? queueBatches : 1;
+  m_thread = std::thread(&ChartStream::run, this);
+  return true;
+}
+
+void ChartStream::waitUntilReady(void)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_ready && !m_done) m_changed.wait(lock);
+}
+
+bool ChartStream::finished(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_done && m_queue.empty();
+}
+
+bool ChartStream::failed(void)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_failed;
+}
+
+bool ChartStream::drainInto(NoteChart& chart)
+{
+  std::deque<StreamBatch> batches;
+  bool more;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    batches.swap(m_queue);
+    more = !m_done;
+  }
+  if (!batches.empty()) m_changed.notify_all();
+
+  for (size_t b = 0; b < batches.size(); b++) {
+    const StreamBatch& batch = batches[b];
+    for (size_t i = 0; i < batch.tempos.size(); i++) {
+      chart.addTempo(batch.tempos[i].tick, (int)batch.tempos[i].microsecondsPerQuarter);
+    }
+    if (chart.size() + batch.notes.size() > chart.capacity()) {
+      chart.reserve(std::max(chart.capacity() * 2, chart.size() + batch.notes.size()));
+    }
+    for (size_t i = 0; i < batch.notes.size(); i++) {
+      const StreamNote& note = batch.notes[i];
+      chart.push_back(note.time_us, 0, note.key, note.key % CHART_LANES, note.channel);
+    }
+    for (size_t i = 0; i < batch.durations.size(); i++) {
+      chart.setDuration(batch.durations[i].index, batch.durations[i].duration_us);
+    }
+  }
+  return more || !batches.empty();
+}
+
+// Hand a batch to the game, waiting while the queue is full.  decoded_us is
+// how far into the song every track has been decoded.
+void ChartStream::push(StreamBatch& batch, int64_t decoded_us)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_queue.size() >= m_capacity) {
+    // a full queue is as much lookahead as the game is going to get
+    m_ready = true;
+    m_changed.notify_all();
+    while (m_queue.size() >= m_capacity && !m_stopping) m_changed.wait(lock);
+  }
+  if (m_stopping) return;
+
+  m_queue.push_back(StreamBatch());
+  m_queue.back().notes.swap(batch.notes);
+  m_queue.back().durations.swap(batch.durations);
+  m_queue.back().tempos.swap(batch.tempos);
+  if (decoded_us >= m_lookahead_us) m_ready = true;
+  lock.unlock();
+  m_changed.notify_all();
+}
+
+void ChartStream::run(void)
+{
+  SmfLayout layout;
+  readSmfLayout((const unsigned char*)m_bytes.data(), m_bytes.size(), layout);
+
+  // one decoder per track, merged by (tick, track) through a min-heap
+  size_t tracks = layout.tracks.size();
+  std::vector<SmfTrackDecoder> decoders(tracks);
+  std::vector<SmfEvent> heads(tracks);
+  typedef std::pair<int64_t, size_t> HeapEntry;
+  std::vector<HeapEntry> heap;
+  for (size_t t = 0; t < tracks; t++) {
+    decoders[t].reset(layout.tracks[t]);
+    if (decoders[t].next(heads[t])) heap.push_back(HeapEntry(heads[t].tick, t));
+  }
+  std::make_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+
+  // events arrive in tick order, so tempo changes can be appended as they come
+  TempoMap tempoMap(layout.division);
+  size_t tempoHint = 0;
+
+  // notes pair within their own track, as they do in a cold compile
+  std::vector<NoteLinker> linkers(tracks);
+  uint64_t noteCount = 0;
+  bool corrupt = false;
+
+  StreamBatch batch;
+  int64_t batchStart = 0;
+
+  while (!heap.empty()) {
+    if (m_stopping) return;
+
+    std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    size_t track = heap.back().second;
+    heap.pop_back();
+    const SmfEvent& event = heads[track];
+    int64_t time_us = tempoMap.toMicros(event.tick, tempoHint);
+
+    if (isSmfTempo(event)) {
+      tempoMap.addTempo(event.tick, smfTempo(event));
+      ChartTempo tempo = { event.tick, smfTempo(event) };
+      batch.tempos.push_back(tempo);
+    } else if (isSmfNoteOn(event)) {
+      StreamNote note = { time_us, event.data[0], (uint8_t)(event.status & 0x0F) };
+      batch.notes.push_back(note);
+      linkers[track].noteOn(noteCount++, event.status & 0x0F, event.data[0], time_us);
+    } else if (isSmfNoteOff(event)) {
+      StreamDuration duration;
+      if (linkers[track].noteOff(event.status & 0x0F, event.data[0], time_us, duration.index, duration.duration_us)) {
+        batch.durations.push_back(duration);
+      }
+    }
+
+    if (decoders[track].next(heads[track])) {
+      heap.push_back(HeapEntry(heads[track].tick, track));
+      std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    } else if (decoders[track].corrupt()) {
+      corrupt = true;
+    }
+
+    if (batch.notes.size() >= BATCH_NOTES || time_us - batchStart >= BATCH_US) {
+      if (!batch.notes.empty() || !batch.durations.empty() || !batch.tempos.empty()) push(batch, time_us);
+      batchStart = time_us;
+    }
+  }
+
+  if (!batch.notes.empty() || !batch.durations.empty() || !batch.tempos.empty()) push(batch, INT64_MAX);
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_failed = corrupt && noteCount == 0;
+  m_done = true;
+  m_changed.notify_all();
+}
@@ -0,0 +1,94 @@
+/* chart-stream.h
+
+Progressive chart loading.  A background thread decodes the MTrk chunks of a
+Standard MIDI File directly, merging all tracks by time as it goes, and hands
+the game time-ordered batches of notes through a bounded queue.  The game can
+start as soon as the first lookahead window of notes has arrived instead of
+waiting for the whole file to be parsed.
+
+Notes are sent the moment their note on is decoded; their durations follow in
+a later batch once the matching note off in the same track turns up, so notes
+pair exactly as they do in a cold compile.  Tempo changes travel with the
+notes, so the chart's tempo map grows as the song arrives.
+*/
+
+#ifndef _CHART_STREAM_H_INCLUDED
+#define _CHART_STREAM_H_INCLUDED
+
+#include "note-chart.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Structs */
+struct StreamNote {
+  int64_t time_us;
+  uint8_t key;
+  uint8_t channel;
+};
+
+struct StreamDuration {
+  uint64_t index;        // chart index of the note
+  int64_t  duration_us;
+};
+
+struct StreamBatch {
+  std::vector<StreamNote>     notes;
+  std::vector<StreamDuration> durations;
+  std::vector<ChartTempo>     tempos;
+};
+
+class ChartStream {
+  public:
+    ChartStream(void);
+    ~ChartStream();
+
+    // Start decoding the MIDI file bytes on a background thread.  Fails if
+    // the bytes are not a Standard MIDI File.
+    bool start(const std::string& bytes, int64_t lookahead_us, size_t queueBatches = 64);
+
+    // Block until the first lookahead_us of notes are queued or the file
+    // has been fully decoded.
+    void waitUntilReady(void);
+
+    // Move everything queued so far into chart without blocking.  Returns
+    // false once the stream is finished and fully drained.
+    bool drainInto(NoteChart& chart);
+
+    bool finished(void);
+    bool failed(void);
+
+    // MIDI file division, valid once start() succeeded
+    int division(void) const { return m_division; }
+
+  private:
+    ChartStream(const ChartStream&);
+    ChartStream& operator=(const ChartStream&);
+
+    void run(void);
+    void push(StreamBatch& batch, int64_t decoded_us);
+    void stop(void);
+
+    std::string             m_bytes;
+    int64_t                 m_lookahead_us;
+    int                     m_division;
+    size_t                  m_capacity;
+
+    std::thread             m_thread;
+    std::mutex              m_mutex;
+    std::condition_variable m_changed;
+    std::deque<StreamBatch> m_queue;
+    bool                    m_ready;
+    bool                    m_done;
+    bool                    m_failed;
+    std::atomic<bool>       m_stopping;
+};
+
+#endif /* _CHART_STREAM_H_INCLUDED */
@@ -1 +1,3 @@
-g++ -w -o terminal-hero terminal-hero.cpp -Iinclude ./lib/libmidifile.a `pkg-config fluidsynth --libs` -lcurses
\ No newline at end of file
+g++ -std=c++11 -pthread -Wall -Wextra -o terminal-hero terminal-hero.cpp note-chart.cpp chart-cache.cpp chart-stream.cpp smf-decoder.cpp event-store.cpp midi-join.cpp tempo-map.cpp scroll-scheduler.cpp judge.cpp audio-thread.cpp timer-wheel.cpp backing-track.cpp calibration.cpp offline-render.cpp framebuffer.cpp ansi-terminal.cpp lane-map.cpp song-library.cpp soundfont-load.cpp soundfont-presets.cpp -Iinclude ./lib/libmidifile.a `pkg-config fluidsynth --libs` -lcurses
+g++ -std=c++11 -pthread -Wall -Wextra -o terminal-hero-compile terminal-hero-compile.cpp song-library.cpp note-chart.cpp chart-cache.cpp smf-decoder.cpp event-store.cpp midi-join.cpp tempo-map.cpp -Iinclude ./lib/libmidifile.a
+g++ -std=c++11 -pthread -Wall -Wextra -o terminal-hero-check terminal-hero-check.cpp note-chart.cpp chart-cache.cpp chart-stream.cpp smf-decoder.cpp event-store.cpp midi-join.cpp tempo-map.cpp scroll-scheduler.cpp backing-track.cpp judge.cpp timer-wheel.cpp lane-map.cpp -Iinclude ./lib/libmidifile.a `pkg-config fluidsynth --libs`
@@ -0,0 +1,86 @@
+/* event-store.cpp
+
+Decodes MIDI files into an EventStore.
+*/
+#include "event-store.h"
+#include "parallel.h"
+
+#include <string.h>
+
+static_assert(sizeof(CompactEvent) == 16, "CompactEvent should stay 16 bytes");
+
+EventStore::EventStore(void)
+  : m_division(120)
+{
+}
+
+void EventStore::clear(void)
+{
+  m_tracks.clear();
+  m_division = 120;
+}
+
+size_t EventStore::getEventCount(void) const
+{
+  size_t count = 0;
+  for (size_t t = 0; t < m_tracks.size(); t++) count += m_tracks[t].m_events.size();
+  return count;
+}
+
+size_t EventStore::memoryUsage(void) const
+{
+  size_t bytes = m_tracks.capacity() * sizeof(EventTrack);
+  for (size_t t = 0; t < m_tracks.size(); t++) {
+    bytes += m_tracks[t].m_events.capacity() * sizeof(CompactEvent);
+    bytes += m_tracks[t].m_payload.capacity();
+  }
+  return bytes;
+}
+
+bool EventStore::read(const unsigned char* bytes, size_t length, int threads)
+{
+  clear();
+
+  SmfLayout layout;
+  if (!readSmfLayout(bytes, length, layout)) return false;
+  m_division = layout.division;
+
+  // chunks are independent until their events are merged by time
+  m_tracks.resize(layout.tracks.size());
+  parallelFor((int)layout.tracks.size(), threads, [&](int track) {
+    m_tracks[track].decode(layout.tracks[track]);
+  });
+  return true;
+}
+
+void EventTrack::decode(const SmfTrackChunk& chunk)
+{
+  // a counting pass first, so the arena and payload are allocated once
+  size_t count = 0;
+  size_t payloadBytes = 0;
+  SmfTrackDecoder decoder(chunk);
+  SmfEvent event;
+  while (decoder.next(event)) {
+    count++;
+    if (event.length > INLINE_EVENT_BYTES) payloadBytes += event.length;
+  }
+  m_events.reserve(count);
+  m_payload.reserve(payloadBytes);
+
+  decoder.reset(chunk);
+  while (decoder.next(event)) {
+    CompactEvent compact;
+    memset(&compact, 0, sizeof(compact));
+    compact.tick = (int32_t)event.tick;
+    compact.length = event.length;
+    compact.status = event.status;
+    compact.metaType = event.metaType;
+    if (event.length <= INLINE_EVENT_BYTES) {
+      memcpy(compact.data.bytes, event.data, event.length);
+    } else {
+      compact.data.offset = (uint32_t)m_payload.size();
+      m_payload.insert(m_payload.end(), event.data, event.data + event.length);
+    }
+    m_events.push_back(compact);
+  }
+}
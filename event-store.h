@@ -0,0 +1,92 @@
+/* event-store.h
+
+Compact, read-only storage for every event of a MIDI file.  Each track is one
+contiguous array of 16 byte records; messages of up to three data bytes live
+inline in the record and longer meta/sysex payloads go to a single side
+buffer shared by all tracks.  A whole file costs one allocation per track plus
+one for the payloads, instead of two per event for smf::MidiEvent.
+*/
+
+#ifndef _EVENT_STORE_H_INCLUDED
+#define _EVENT_STORE_H_INCLUDED
+
+#include "smf-decoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Constants */
+const uint32_t INLINE_EVENT_BYTES = 3;
+
+/* Structs */
+struct CompactEvent {
+  int32_t  tick;      // absolute tick
+  uint32_t length;    // number of data bytes
+  uint8_t  status;    // channel status byte, 0xF0/0xF7 sysex or SMF_META
+  uint8_t  metaType;  // meta events only
+  uint8_t  unused[2];
+  union {
+    uint8_t  bytes[4];   // length <= INLINE_EVENT_BYTES
+    uint32_t offset;     // into the track's payload buffer otherwise
+  } data;
+
+  int channel(void) const { return status & 0x0F; }
+  int key(void) const { return data.bytes[0] & 0x7F; }
+  bool isNoteOn(void) const { return (status & 0xF0) == 0x90 && length >= 2 && data.bytes[1] > 0; }
+  bool isNoteOff(void) const { return length >= 2 && ((status & 0xF0) == 0x80 || ((status & 0xF0) == 0x90 && data.bytes[1] == 0)); }
+  bool isMeta(void) const { return status == SMF_META; }
+  bool isTempo(void) const { return status == SMF_META && metaType == SMF_META_TEMPO && length >= 3; }
+};
+
+// Read-only view of one track, in file order.
+class EventTrack {
+  public:
+    const CompactEvent& operator[](int index) const { return m_events[index]; }
+    int size(void) const { return (int)m_events.size(); }
+
+    // The data bytes of an event from this track.
+    const uint8_t* data(const CompactEvent& event) const
+    {
+      return event.length <= INLINE_EVENT_BYTES ? event.data.bytes : &m_payload[event.data.offset];
+    }
+
+    int tempo(const CompactEvent& event) const
+    {
+      const uint8_t* bytes = data(event);
+      return (bytes[0] << 16) | (bytes[1] << 8) | bytes[2];
+    }
+
+  private:
+    void decode(const SmfTrackChunk& chunk);
+
+    std::vector<CompactEvent> m_events;
+    std::vector<uint8_t>      m_payload;
+
+  friend class EventStore;
+};
+
+class EventStore {
+  public:
+    EventStore(void);
+
+    // Decode a Standard MIDI File, one track per thread.  False if the
+    // bytes are not a Standard MIDI File.
+    bool read(const unsigned char* bytes, size_t length, int threads = 1);
+    void clear(void);
+
+    const EventTrack& operator[](int track) const { return m_tracks[track]; }
+    int getTrackCount(void) const { return (int)m_tracks.size(); }
+    int size(void) const { return getTrackCount(); }
+    int getDivision(void) const { return m_division; }
+    size_t getEventCount(void) const;
+
+    // Bytes held by the arenas and payload buffers.
+    size_t memoryUsage(void) const;
+
+  private:
+    std::vector<EventTrack> m_tracks;
+    int                     m_division;
+};
+
+#endif /* _EVENT_STORE_H_INCLUDED */
@@ -0,0 +1,96 @@
+/* framebuffer.cpp
+
+Cell grid diffing.
+*/
+#include "framebuffer.h"
+#include "ansi-terminal.h"
+
+#include <ncurses.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+// flushTo() output for curses, the color pairs are curses' own
+struct CursesOutput {
+  void moveTo(unsigned int x, unsigned int y) { move(y, x); }
+  void setPair(short pair) { attrset(COLOR_PAIR(pair)); }
+  void putGlyph(uint32_t glyph) { addch(glyph & GLYPH_ACS ? NCURSES_ACS(glyph & 0xFF) : (chtype)glyph); }
+};
+
+static bool sameCell(const Cell& a, const Cell& b)
+{
+  return a.glyph == b.glyph && a.pair == b.pair;
+}
+
+Framebuffer::Framebuffer(unsigned int width, unsigned int height)
+  : m_width(width), m_height(height), m_cellsWritten(0), m_runs(0)
+{
+  Cell empty = { 0, 0 };
+  m_cells.assign((size_t)width * height, empty);
+  m_shown.assign((size_t)width * height, empty);
+}
+
+void Framebuffer::put(unsigned int x, unsigned int y, uint32_t glyph, short pair)
+{
+  if (x >= m_width || y >= m_height) return;
+  Cell& cell = m_cells[(size_t)y * m_width + x];
+  cell.glyph = glyph;
+  cell.pair = pair;
+}
+
+void Framebuffer::print(unsigned int x, unsigned int y, short pair, const char* format, ...)
+{
+  char text[256];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+  for (const char* c = text; *c && x < m_width; c++, x++) put(x, y, (unsigned char)*c, pair);
+}
+
+template <typename Output>
+void Framebuffer::flushTo(Output& output)
+{
+  short pair = -1;
+  for (unsigned int y = 0; y < m_height; y++) {
+    Cell* row = &m_cells[(size_t)y * m_width];
+    Cell* shown = &m_shown[(size_t)y * m_width];
+    unsigned int x = 0;
+    while (x < m_width) {
+      if (!row[x].glyph || sameCell(row[x], shown[x])) {
+        x++;
+        continue;
+      }
+
+      // one move for the run, every glyph advances the cursor along it
+      output.moveTo(x, y);
+      m_runs++;
+      while (x < m_width && row[x].glyph && !sameCell(row[x], shown[x])) {
+        if (row[x].pair != pair) {
+          pair = row[x].pair;
+          output.setPair(pair);
+        }
+        output.putGlyph(row[x].glyph);
+        shown[x] = row[x];
+        m_cellsWritten++;
+        x++;
+      }
+    }
+  }
+}
+
+void Framebuffer::flush(void)
+{
+  CursesOutput output;
+  flushTo(output);
+}
+
+void Framebuffer::flush(AnsiTerminal& terminal)
+{
+  flushTo(terminal);
+}
+
+void Framebuffer::invalidate(void)
+{
+  Cell empty = { 0, 0 };
+  m_shown.assign(m_shown.size(), empty);
+}
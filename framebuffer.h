@@ -0,0 +1,74 @@
+/* framebuffer.h
+
+Damage-tracked drawing.  Each frame is drawn into an in-memory grid of cells
+(glyph and color pair) instead of straight to the terminal.  flush() compares
+the grid with what it sent last frame and passes on only the cells that
+changed, one cursor move per run of changed cells in a row and one color
+change per color change inside a run, so an idle board costs nothing.
+
+A frame can be flushed to curses, or to an AnsiTerminal which sends it as
+one block of escape sequences.  Glyphs are plain characters or VT100 line
+drawing characters, so neither backend needs the other's tables.
+
+Cells nobody has drawn are left alone.
+*/
+
+#ifndef _FRAMEBUFFER_H_INCLUDED
+#define _FRAMEBUFFER_H_INCLUDED
+
+#include <stdint.h>
+#include <vector>
+
+class AnsiTerminal;
+
+/* Constants */
+// A glyph is a character, or GLYPH_ACS plus the VT100 alternate character
+// set letter of a line drawing character (what curses' ACS_ macros map).
+const uint32_t GLYPH_ACS       = 0x100;
+const uint32_t GLYPH_DIAMOND   = GLYPH_ACS | '`';
+const uint32_t GLYPH_S1        = GLYPH_ACS | 'o';  // scan line 1, top of the cell
+const uint32_t GLYPH_S3        = GLYPH_ACS | 'p';
+const uint32_t GLYPH_S7        = GLYPH_ACS | 'r';
+const uint32_t GLYPH_HLINE     = GLYPH_ACS | 'q';
+const uint32_t GLYPH_VLINE     = GLYPH_ACS | 'x';
+const uint32_t GLYPH_ULCORNER  = GLYPH_ACS | 'l';
+const uint32_t GLYPH_URCORNER  = GLYPH_ACS | 'k';
+const uint32_t GLYPH_LLCORNER  = GLYPH_ACS | 'm';
+const uint32_t GLYPH_LRCORNER  = GLYPH_ACS | 'j';
+
+/* Structs */
+struct Cell {
+  uint32_t glyph;  // 0: not owned by the framebuffer
+  short    pair;
+};
+
+class Framebuffer {
+  public:
+    Framebuffer(unsigned int width, unsigned int height);
+
+    void put(unsigned int x, unsigned int y, uint32_t glyph, short pair);
+    // printf into the cells from x along row y, clipped at the right edge
+    void print(unsigned int x, unsigned int y, short pair, const char* format, ...);
+
+    // Write the changed cells to stdscr, the caller refreshes.
+    void flush(void);
+    // Append the changed cells to terminal's frame, the caller presents it.
+    void flush(AnsiTerminal& terminal);
+    // Forget what the terminal shows, the next flush() rewrites every cell.
+    void invalidate(void);
+
+    uint64_t cellsWritten(void) const { return m_cellsWritten; }
+    uint64_t runs(void) const { return m_runs; }
+
+  private:
+    template <typename Output> void flushTo(Output& output);
+
+    unsigned int      m_width;
+    unsigned int      m_height;
+    std::vector<Cell> m_cells;
+    std::vector<Cell> m_shown;
+    uint64_t          m_cellsWritten;
+    uint64_t          m_runs;
+};
+
+#endif /* _FRAMEBUFFER_H_INCLUDED */
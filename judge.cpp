@@ -0,0 +1,133 @@
+/* judge.cpp
+
+Per-lane hit judgment.
+*/
+#include "judge.h"
+
+#include <algorithm>
+
+static const JudgeWindows DEFAULT_WINDOWS = { 25000, 50000, 100000, 150000 };
+
+Judge::Judge(unsigned int lanes)
+  : m_lanes(lanes ? lanes : 1), m_windows(DEFAULT_WINDOWS), m_log(NULL)
+{
+  clear();
+}
+
+void Judge::clear(void)
+{
+  for (size_t i = 0; i < m_lanes.size(); i++) {
+    m_lanes[i].notes.clear();
+    m_lanes[i].head = 0;
+  }
+  for (int i = 0; i < JUDGE_COUNT; i++) m_counts[i] = 0;
+}
+
+void Judge::add(unsigned int lane, int64_t hit_us, int key, size_t note)
+{
+  if (lane >= m_lanes.size()) return;
+  std::vector<LaneNote>& notes = m_lanes[lane].notes;
+  if (notes.size() > m_lanes[lane].head && notes.back().hit_us == hit_us) {
+    notes.back().key = key;
+    notes.back().note = note;
+    return;
+  }
+  LaneNote entry = { hit_us, note, key, false };
+  notes.push_back(entry);
+}
+
+bool Judge::hitBefore(const LaneNote& note, int64_t press_us)
+{
+  return note.hit_us < press_us;
+}
+
+Judgment Judge::grade(int64_t offset_us) const
+{
+  int64_t distance = offset_us < 0 ? -offset_us : offset_us;
+  if (distance <= m_windows.perfect_us) return JUDGE_PERFECT;
+  if (distance <= m_windows.great_us) return JUDGE_GREAT;
+  if (distance <= m_windows.good_us) return JUDGE_GOOD;
+  return JUDGE_MISS;
+}
+
+JudgeResult Judge::press(unsigned int lane, int64_t press_us)
+{
+  JudgeResult result = { JUDGE_NONE, 0, 0, 0 };
+  if (lane >= m_lanes.size()) return result;
+  std::vector<LaneNote>& notes = m_lanes[lane].notes;
+  size_t head = m_lanes[lane].head;
+
+  size_t first = std::lower_bound(notes.begin() + head, notes.end(), press_us, hitBefore) - notes.begin();
+
+  // nearest unjudged note on either side, judged notes can only be skipped
+  // inside the window so this stays bounded
+  size_t best = notes.size();
+  for (size_t i = first; i < notes.size() && notes[i].hit_us - press_us <= m_windows.miss_us; i++) {
+    if (!notes[i].judged) {
+      best = i;
+      break;
+    }
+  }
+  for (size_t i = first; i-- > head && press_us - notes[i].hit_us <= m_windows.good_us;) {
+    if (!notes[i].judged) {
+      if (best == notes.size() || press_us - notes[i].hit_us < notes[best].hit_us - press_us) best = i;
+      break;
+    }
+  }
+  if (best == notes.size()) return result;
+
+  notes[best].judged = true;
+  result.key = notes[best].key;
+  result.note = notes[best].note;
+  result.offset_us = press_us - notes[best].hit_us;
+  result.grade = grade(result.offset_us);
+  m_counts[result.grade]++;
+  record(lane, notes[best], result.grade, result.offset_us);
+  return result;
+}
+
+int Judge::expire(int64_t now_us)
+{
+  int missed = 0;
+  for (size_t l = 0; l < m_lanes.size(); l++) {
+    Lane& lane = m_lanes[l];
+    while (lane.head < lane.notes.size() &&
+           (lane.notes[lane.head].judged || lane.notes[lane.head].hit_us + m_windows.good_us < now_us)) {
+      if (!lane.notes[lane.head].judged) {
+        lane.notes[lane.head].judged = true;
+        m_counts[JUDGE_MISS]++;
+        record(l, lane.notes[lane.head], JUDGE_MISS, 0);
+        missed++;
+      }
+      lane.head++;
+    }
+    compact(lane);
+  }
+  return missed;
+}
+
+int64_t Judge::nextHit(unsigned int lane) const
+{
+  if (lane >= m_lanes.size()) return -1;
+  const std::vector<LaneNote>& notes = m_lanes[lane].notes;
+  for (size_t i = m_lanes[lane].head; i < notes.size(); i++) {
+    if (!notes[i].judged) return notes[i].hit_us;
+  }
+  return -1;
+}
+
+void Judge::record(unsigned int lane, const LaneNote& note, Judgment grade, int64_t offset_us)
+{
+  if (!m_log) return;
+  JudgeRecord entry = { lane, note.hit_us, { grade, note.key, note.note, offset_us } };
+  m_log->push_back(entry);
+}
+
+// Drop judged notes once they are most of the queue, so a long song does not
+// keep every note it has ever seen.
+void Judge::compact(Lane& lane)
+{
+  if (lane.head < 1024 || lane.head * 2 < lane.notes.size()) return;
+  lane.notes.erase(lane.notes.begin(), lane.notes.begin() + lane.head);
+  lane.head = 0;
+}
@@ -0,0 +1,102 @@
+/* judge.h
+
+Hit judgment.  Every note on the board gets an ideal hit time and a lane;
+each lane keeps its notes in a queue sorted by hit time.  A key press is
+graded against the nearest unjudged note in its lane, found by binary search,
+and notes whose window has closed are counted as misses as time passes,
+whether or not a key was pressed.
+*/
+
+#ifndef _JUDGE_H_INCLUDED
+#define _JUDGE_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Constants */
+enum Judgment {
+  JUDGE_NONE = -1,  // no note near the press
+  JUDGE_PERFECT,
+  JUDGE_GREAT,
+  JUDGE_GOOD,
+  JUDGE_MISS,
+  JUDGE_COUNT
+};
+
+/* Structs */
+// Half widths of the timing windows, a press up to good_us away from a note
+// hits it, up to miss_us early breaks it.
+struct JudgeWindows {
+  int64_t perfect_us;
+  int64_t great_us;
+  int64_t good_us;
+  int64_t miss_us;
+};
+
+struct JudgeResult {
+  Judgment grade;
+  int      key;        // MIDI key of the judged note
+  size_t   note;       // caller's index for it, see Judge::add()
+  int64_t  offset_us;  // press time - hit time, negative when early
+};
+
+// One judged note, for callers that keep a log of every judgment.
+struct JudgeRecord {
+  unsigned int lane;
+  int64_t      hit_us;
+  JudgeResult  result;  // offset_us is 0 for notes that expired unplayed
+};
+
+class Judge {
+  public:
+    explicit Judge(unsigned int lanes = 4);
+
+    void setWindows(const JudgeWindows& windows) { m_windows = windows; }
+    const JudgeWindows& windows(void) const { return m_windows; }
+    void clear(void);
+
+    // Notes must be added in non-decreasing hit time order within a lane.
+    // A second note at the same time in the same lane replaces the first,
+    // the board only has room for one.  note is handed back in the result.
+    void add(unsigned int lane, int64_t hit_us, int key, size_t note);
+
+    // Grade a key press against the nearest unjudged note in lane.
+    JudgeResult press(unsigned int lane, int64_t press_us);
+
+    // Count every note whose window closed before now_us as missed,
+    // returning how many were.
+    int expire(int64_t now_us);
+
+    uint64_t count(Judgment grade) const { return m_counts[grade]; }
+
+    // Hit time of the next unjudged note in lane, -1 if there is none.
+    int64_t nextHit(unsigned int lane) const;
+
+    // Append every judgment, presses and expiries alike, to log.  NULL stops.
+    void setLog(std::vector<JudgeRecord>* log) { m_log = log; }
+
+  private:
+    struct LaneNote {
+      int64_t hit_us;
+      size_t  note;
+      int     key;
+      bool    judged;
+    };
+    struct Lane {
+      std::vector<LaneNote> notes;
+      size_t head;  // notes before head are judged or expired
+    };
+
+    static bool hitBefore(const LaneNote& note, int64_t press_us);
+    Judgment grade(int64_t offset_us) const;
+    void compact(Lane& lane);
+    void record(unsigned int lane, const LaneNote& note, Judgment grade, int64_t offset_us);
+
+    std::vector<Lane> m_lanes;
+    JudgeWindows      m_windows;
+    uint64_t          m_counts[JUDGE_COUNT];
+    std::vector<JudgeRecord>* m_log;
+};
+
+#endif /* _JUDGE_H_INCLUDED */
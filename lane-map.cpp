@@ -0,0 +1,147 @@
+/* lane-map.cpp
+
+Chord grouping, melodic contour and density thinning for the lane map.
+*/
+#include "lane-map.h"
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+// positions are in 64ths of a quarter note, a board row is 16 of them
+static const int64_t POSITION_PER_QUARTER = 64;
+static const int64_t POSITION_PER_ROW = POSITION_PER_QUARTER / 4;
+// played (not quantized) files land a little early now and then
+static const int64_t POSITION_SLACK = 2;
+// SMPTE files have no quarter notes, use 120 bpm
+static const int64_t SMPTE_QUARTER_US = 500000;
+
+struct KeyBefore {
+  const NoteChart* chart;
+  bool operator()(size_t a, size_t b) const
+  {
+    if (chart->key[a] != chart->key[b]) return chart->key[a] < chart->key[b];
+    return a < b;
+  }
+};
+
+LaneMap::LaneMap(void)
+{
+  reset(0xFFFF);
+}
+
+void LaneMap::reset(uint16_t channels)
+{
+  m_channels = channels;
+  m_mapped = 0;
+  for (int tier = 0; tier < DIFFICULTY_COUNT; tier++) {
+    m_lanes[tier].clear();
+    m_lastPosition[tier] = -1;
+    m_lastKey[tier] = 0;
+    m_lastLane[tier] = 0;
+    m_notes[tier] = 0;
+  }
+}
+
+int64_t LaneMap::position(const NoteChart& chart, int64_t time_us) const
+{
+  const TempoMap& tempoMap = chart.tempoMap();
+  if (tempoMap.isSmpte()) return time_us * POSITION_PER_QUARTER / SMPTE_QUARTER_US;
+  return tempoMap.toTick(time_us) * POSITION_PER_QUARTER / tempoMap.ticksPerQuarter();
+}
+
+void LaneMap::extend(const NoteChart& chart, bool complete)
+{
+  size_t count = chart.size();
+  for (int tier = 0; tier < DIFFICULTY_COUNT; tier++) m_lanes[tier].resize(count, LANE_NONE);
+
+  size_t next = m_mapped;
+  while (next < count) {
+    // other channels are the backing track's
+    if (!(m_channels & (1 << chart.channel[next]))) {
+      next++;
+      continue;
+    }
+    size_t end = next + 1;
+    while (end < count && chart.time_us[end] - chart.time_us[next] <= CHORD_WINDOW_US) end++;
+    if (end == count && !complete) break;
+    mapGroup(chart, next, end);
+    next = end;
+  }
+  m_mapped = next;
+}
+
+// Lanes for the player's notes in [begin, end), which start together.
+void LaneMap::mapGroup(const NoteChart& chart, size_t begin, size_t end)
+{
+  m_group.clear();
+  for (size_t i = begin; i < end; i++) {
+    if (m_channels & (1 << chart.channel[i])) m_group.push_back(i);
+  }
+  KeyBefore byKey = { &chart };
+  std::sort(m_group.begin(), m_group.end(), byKey);
+  // a key doubled on another channel is one note to play
+  size_t keys = 0;
+  for (size_t i = 0; i < m_group.size(); i++) {
+    if (keys && chart.key[m_group[i]] == chart.key[m_group[keys - 1]]) continue;
+    m_group[keys++] = m_group[i];
+  }
+
+  int topKey = chart.key[m_group[keys - 1]];
+  int64_t at = position(chart, chart.time_us[begin]);
+  const int lanes = (int)CHART_LANES;
+
+  for (int tier = 0; tier < DIFFICULTY_COUNT; tier++) {
+    const DifficultyTier& rules = DIFFICULTY_TIERS[tier];
+    if (m_lastPosition[tier] >= 0 && at - m_lastPosition[tier] < rules.minRows * POSITION_PER_ROW - POSITION_SLACK) continue;
+
+    // the melody is usually on top, follow the top note
+    int lane;
+    if (m_lastPosition[tier] < 0) {
+      lane = topKey % lanes;
+    } else {
+      int interval = topKey - m_lastKey[tier];
+      int step = interval == 0 ? 0 : (abs(interval) > LEAP_SEMITONES ? 2 : 1);
+      lane = m_lastLane[tier] + (interval < 0 ? -step : step);
+      if (lane < 0) lane = 0;
+      if (lane >= lanes) lane = lanes - 1;
+      // pinned against the edge, step back in so a new pitch never reads as a repeat
+      if (interval != 0 && lane == m_lastLane[tier]) lane += lane == 0 ? 1 : -1;
+    }
+
+    // keep the top note, then the bass, then inner notes from the top down
+    size_t chord = std::min(keys, (size_t)std::min(rules.maxChord, CHART_LANES));
+    bool kept[128];
+    memset(kept, 0, sizeof(kept));
+    size_t left = chord - 1;
+    kept[keys - 1] = true;
+    if (left && keys > 1) {
+      kept[0] = true;
+      left--;
+    }
+    for (size_t k = keys - 2; left > 0 && k > 0; k--) {
+      kept[k] = true;
+      left--;
+    }
+
+    // the chord ends in the melody's lane, shifted right if it would not fit
+    int top = std::max(lane, (int)chord - 1);
+    int next = top - (int)chord + 1;
+    for (size_t k = 0; k < keys; k++) {
+      if (kept[k]) m_lanes[tier][m_group[k]] = (uint8_t)next++;
+    }
+
+    m_lastPosition[tier] = at;
+    m_lastKey[tier] = topKey;
+    m_lastLane[tier] = top;
+    m_notes[tier] += chord;
+  }
+}
+
+int difficultyByName(const char* name)
+{
+  for (int tier = 0; tier < DIFFICULTY_COUNT; tier++) {
+    if (strcmp(name, DIFFICULTY_TIERS[tier].name) == 0) return tier;
+  }
+  return -1;
+}
@@ -0,0 +1,89 @@
+/* lane-map.h
+
+Lane assignment, worked out once when the chart is loaded instead of while
+notes spawn.  The player's notes are grouped into chords by onset.  Each
+group's lane follows the melody: a higher top note moves right, a lower one
+moves left (two lanes for a leap), a repeated note stays put.  A chord takes
+neighbouring lanes, lowest key on the left.
+
+Every note gets a lane in each difficulty tier.  Easier tiers drop groups
+that come too soon after the last one they kept and play only part of a
+chord, so dense passages thin out but keep the melody's shape.  The map
+depends only on the chart and the player's channels, so a song charts the
+same way on every run, and spawning a note is one table lookup.
+*/
+
+#ifndef _LANE_MAP_H_INCLUDED
+#define _LANE_MAP_H_INCLUDED
+
+#include "note-chart.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Constants */
+const uint8_t LANE_NONE = 0xFF;        // not charted in this tier
+const int64_t CHORD_WINDOW_US = 30000; // notes this close to a group's first note join it
+const int LEAP_SEMITONES = 5;          // wider intervals move two lanes
+
+enum Difficulty {
+  DIFFICULTY_EASY,
+  DIFFICULTY_MEDIUM,
+  DIFFICULTY_HARD,
+  DIFFICULTY_COUNT
+};
+
+/* Structs */
+struct DifficultyTier {
+  const char*  name;
+  unsigned int minRows;   // board rows (16th notes) from one kept group to the next
+  unsigned int maxChord;  // notes kept from a chord
+};
+
+const DifficultyTier DIFFICULTY_TIERS[DIFFICULTY_COUNT] = {
+  { "easy",   4, 1 },
+  { "medium", 2, 2 },
+  { "hard",   0, CHART_LANES },
+};
+
+class LaneMap {
+  public:
+    LaneMap(void);
+
+    // Forget the map and chart only the notes on channels (bit n, channel n).
+    void reset(uint16_t channels);
+
+    // Map the notes added to chart since the last call.  Unless complete,
+    // the last group is held back until a later note shows it has ended.
+    void extend(const NoteChart& chart, bool complete);
+
+    uint8_t lane(unsigned int tier, size_t index) const
+    {
+      return index < m_mapped ? m_lanes[tier][index] : LANE_NONE;
+    }
+    size_t mapped(void) const { return m_mapped; }
+    // notes charted in a tier so far
+    size_t notes(unsigned int tier) const { return m_notes[tier]; }
+
+  private:
+    void mapGroup(const NoteChart& chart, size_t begin, size_t end);
+    int64_t position(const NoteChart& chart, int64_t time_us) const;
+
+    uint16_t             m_channels;
+    size_t               m_mapped;
+    std::vector<uint8_t> m_lanes[DIFFICULTY_COUNT];
+    std::vector<size_t>  m_group;  // scratch, the current group's notes by key
+
+    // per tier, the last group it kept
+    int64_t m_lastPosition[DIFFICULTY_COUNT];  // -1 before the first
+    int     m_lastKey[DIFFICULTY_COUNT];
+    int     m_lastLane[DIFFICULTY_COUNT];
+    size_t  m_notes[DIFFICULTY_COUNT];
+};
+
+/* Function References */
+// Tier called name, or -1.
+int difficultyByName(const char* name);
+
+#endif /* _LANE_MAP_H_INCLUDED */
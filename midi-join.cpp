@@ -0,0 +1,120 @@
+/* midi-join.cpp
+
+k-way merge replacement for smf::MidiFile::joinTracks().
+*/
+#include "midi-join.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace smf;
+
+// Orders events the way eventcompare() does, checking the tick first so the
+// common case never leaves this function.
+static inline bool eventBefore(MidiEvent* a, MidiEvent* b)
+{
+  if (a->tick != b->tick) return a->tick < b->tick;
+  return eventcompare(&a, &b) < 0;
+}
+
+struct MergeHead {
+  MidiEvent* event;
+  int        track;
+};
+
+// min-heap order: earliest event first, lower track first on a tie so the
+// merge is stable with respect to track order
+static inline bool headAfter(const MergeHead& a, const MergeHead& b)
+{
+  if (a.event->tick != b.event->tick) return a.event->tick > b.event->tick;
+  int order = eventcompare(&a.event, &b.event);
+  if (order != 0) return order > 0;
+  return a.track > b.track;
+}
+
+void MergeJoinMidiFile::joinTracks(void)
+{
+  if (getTrackState() == TRACK_STATE_JOINED) return;
+  if (getNumTracks() <= 1) {
+    m_theTrackState = TRACK_STATE_JOINED;
+    return;
+  }
+
+  int oldTimeState = getTickState();
+  if (oldTimeState == TIME_STATE_DELTA) makeAbsoluteTicks();
+
+  // tracks are almost always sorted already, only sort the ones that are not
+  int tracks = getNumTracks();
+  size_t total = 0;
+  for (int track = 0; track < tracks; track++) {
+    MidiEventList& list = *m_events[track];
+    MidiEvent** events = list.data();
+    int count = list.size();
+    total += count;
+    for (int i = 1; i < count; i++) {
+      if (eventBefore(events[i], events[i - 1])) {
+        std::stable_sort(events, events + count, eventBefore);
+        break;
+      }
+    }
+  }
+
+  std::vector<int> cursor(tracks, 0);
+  std::vector<MergeHead> heap;
+  for (int track = 0; track < tracks; track++) {
+    if (m_events[track]->size() > 0) {
+      MergeHead head = { m_events[track]->data()[0], track };
+      heap.push_back(head);
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), headAfter);
+
+  MidiEventList* joined = new MidiEventList;
+  joined->reserve((int)total + 1000);
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), headAfter);
+    MergeHead& head = heap.back();
+    joined->push_back_no_copy(head.event);
+
+    MidiEventList& list = *m_events[head.track];
+    if (++cursor[head.track] < list.size()) {
+      head.event = list.data()[cursor[head.track]];
+      std::push_heap(heap.begin(), heap.end(), headAfter);
+    } else {
+      heap.pop_back();
+    }
+  }
+
+  // the events now belong to the joined track
+  for (int track = 0; track < tracks; track++) {
+    m_events[track]->detach();
+    delete m_events[track];
+  }
+  m_events.resize(1);
+  m_events[0] = joined;
+
+  if (oldTimeState == TIME_STATE_DELTA) makeDeltaTicks();
+  m_theTrackState = TRACK_STATE_JOINED;
+}
+
+int firstJoinDifference(MidiFile& a, MidiFile& b)
+{
+  if (a.getTrackCount() != 1 || b.getTrackCount() != 1) return 0;
+
+  MidiEventList& listA = a[0];
+  MidiEventList& listB = b[0];
+  int count = std::min(listA.size(), listB.size());
+  for (int i = 0; i < count; i++) {
+    MidiEvent& eventA = listA[i];
+    MidiEvent& eventB = listB[i];
+    if (eventA.tick != eventB.tick || eventA.track != eventB.track ||
+        eventA.seq != eventB.seq || eventA.size() != eventB.size()) {
+      return i;
+    }
+    for (int j = 0; j < (int)eventA.size(); j++) {
+      if (eventA[j] != eventB[j]) return i;
+    }
+  }
+
+  return listA.size() == listB.size() ? -1 : count;
+}
@@ -0,0 +1,26 @@
+/* midi-join.h
+
+smf::MidiFile::joinTracks() concatenates every track and qsorts the result,
+even though each track is already in time order.  MergeJoinMidiFile replaces
+it with a k-way heap merge of the tracks: O(n log k) instead of O(n log n),
+comparing ticks inline and only falling back to smf::eventcompare() to break
+ties between events on the same tick.  The joined track comes out in exactly
+the order the library join produces.
+*/
+
+#ifndef _MIDI_JOIN_H_INCLUDED
+#define _MIDI_JOIN_H_INCLUDED
+
+#include "MidiFile.h"
+
+class MergeJoinMidiFile : public smf::MidiFile {
+  public:
+    // Same contract as smf::MidiFile::joinTracks().
+    void joinTracks(void);
+};
+
+// Compare the joined tracks of two files event by event (tick, track, seq
+// and message bytes).  Returns the index of the first difference, or -1.
+int firstJoinDifference(smf::MidiFile& a, smf::MidiFile& b);
+
+#endif /* _MIDI_JOIN_H_INCLUDED */
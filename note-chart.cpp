@@ -0,0 +1,442 @@
+/* note-chart.cpp
+
+Compiles a MidiFile into a NoteChart, and reads/writes chart images.
+*/
+#include "note-chart.h"
+#include "parallel.h"
+#include "tempo-map.h"
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace smf;
+
+static const char CHART_MAGIC[8] = "THCHART";
+
+struct ChartEntry {
+  int64_t time_us;
+  int64_t duration_us;
+  uint8_t key;
+  uint8_t channel;
+};
+
+static bool entryBefore(const ChartEntry& a, const ChartEntry& b)
+{
+  return a.time_us < b.time_us;
+}
+
+struct TempoChange {
+  int32_t tick;
+  int     tempo;
+};
+
+static bool tempoBefore(const TempoChange& a, const TempoChange& b)
+{
+  return a.tick < b.tick;
+}
+
+// replace the chart notes with entries, keeping its source hash and tempo map
+static void fillChart(const std::vector<ChartEntry>& entries, NoteChart& chart)
+{
+  chart.reserve(entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    chart.push_back(entries[i].time_us, entries[i].duration_us, entries[i].key, entries[i].key % CHART_LANES, entries[i].channel);
+  }
+}
+
+// columns are stored widest first so every column stays naturally aligned
+static size_t roundUp8(size_t bytes)
+{
+  return (bytes + 7) & ~(size_t)7;
+}
+
+size_t chartImageSize(size_t count)
+{
+  return sizeof(ChartHeader) + count * 2 * sizeof(int64_t) + roundUp8(count * 3);
+}
+
+/*-------------------\
+|----- NoteChart ----|
+\-------------------*/
+NoteChart::NoteChart(void)
+  : time_us(NULL), duration_us(NULL), key(NULL), lane(NULL), channel(NULL),
+    m_tempoMap(120), m_division(120), m_map(NULL), m_mapLength(0), m_count(0), m_capacity(0), m_sourceHash(0)
+{
+}
+
+NoteChart::~NoteChart()
+{
+  unmap();
+}
+
+void NoteChart::layout(unsigned char* base, size_t capacity)
+{
+  unsigned char* column = base + sizeof(ChartHeader);
+  time_us = (const int64_t*)column;
+  column += capacity * sizeof(int64_t);
+  duration_us = (const int64_t*)column;
+  column += capacity * sizeof(int64_t);
+  key = column;
+  column += capacity;
+  lane = column;
+  column += capacity;
+  channel = column;
+  m_capacity = capacity;
+}
+
+void NoteChart::unmap(void)
+{
+  if (m_map) munmap(m_map, m_mapLength);
+  m_map = NULL;
+  m_mapLength = 0;
+}
+
+void NoteChart::clear(void)
+{
+  unmap();
+  m_heap.clear();
+  m_tempos.clear();
+  m_tempoMap.reset(120);
+  m_division = 120;
+  m_count = 0;
+  m_capacity = 0;
+  time_us = duration_us = NULL;
+  key = lane = channel = NULL;
+}
+
+void NoteChart::reserve(size_t capacity)
+{
+  if (!m_map && capacity <= m_capacity) return;
+
+  std::vector<uint64_t> heap((chartImageSize(capacity) + 7) / 8);
+  const int64_t* oldTime = time_us;
+  const int64_t* oldDuration = duration_us;
+  const uint8_t* oldKey = key;
+  const uint8_t* oldLane = lane;
+  const uint8_t* oldChannel = channel;
+
+  layout((unsigned char*)&heap[0], capacity);
+  if (m_count) {
+    memcpy((void*)time_us, oldTime, m_count * sizeof(int64_t));
+    memcpy((void*)duration_us, oldDuration, m_count * sizeof(int64_t));
+    memcpy((void*)key, oldKey, m_count);
+    memcpy((void*)lane, oldLane, m_count);
+    memcpy((void*)channel, oldChannel, m_count);
+  }
+
+  unmap();
+  m_heap.swap(heap);
+}
+
+void NoteChart::push_back(int64_t time, int64_t duration, uint8_t noteKey, uint8_t noteLane, uint8_t noteChannel)
+{
+  if (m_map || m_count == m_capacity) reserve(m_capacity ? m_capacity * 2 : 64);
+  ((int64_t*)time_us)[m_count] = time;
+  ((int64_t*)duration_us)[m_count] = duration;
+  ((uint8_t*)key)[m_count] = noteKey;
+  ((uint8_t*)lane)[m_count] = noteLane;
+  ((uint8_t*)channel)[m_count] = noteChannel;
+  m_count++;
+}
+
+void NoteChart::setDivision(int division)
+{
+  m_division = division;
+  m_tempos.clear();
+  m_tempoMap.reset(division);
+}
+
+void NoteChart::addTempo(int64_t tick, int microsecondsPerQuarter)
+{
+  ChartTempo tempo = { tick, microsecondsPerQuarter };
+  m_tempos.push_back(tempo);
+  m_tempoMap.addTempo(tick, microsecondsPerQuarter);
+}
+
+void NoteChart::setDuration(size_t index, int64_t duration)
+{
+  if (index >= m_count) return;
+  if (m_map) reserve(m_count);
+  ((int64_t*)duration_us)[index] = duration;
+}
+
+bool NoteChart::mapFile(const std::string& filename, uint64_t hash)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat info;
+  if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(ChartHeader)) {
+    close(fd);
+    return false;
+  }
+
+  size_t length = (size_t)info.st_size;
+  void* map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  const ChartHeader* header = (const ChartHeader*)map;
+  if (memcmp(header->magic, CHART_MAGIC, sizeof(CHART_MAGIC)) != 0 ||
+      header->version != CHART_VERSION ||
+      header->headerSize != sizeof(ChartHeader) ||
+      header->sourceHash != hash ||
+      chartImageSize(header->count) + header->tempoCount * sizeof(ChartTempo) != length) {
+    munmap(map, length);
+    return false;
+  }
+
+  clear();
+  m_map = map;
+  m_mapLength = length;
+  m_count = header->count;
+  m_sourceHash = hash;
+  layout((unsigned char*)map, m_count);
+
+  const ChartTempo* tempos = (const ChartTempo*)((const unsigned char*)map + chartImageSize(m_count));
+  setDivision(header->division);
+  for (uint32_t i = 0; i < header->tempoCount; i++) addTempo(tempos[i].tick, (int)tempos[i].microsecondsPerQuarter);
+  return true;
+}
+
+bool NoteChart::writeFile(const std::string& filename) const
+{
+  // write to a temporary and rename so readers never map a partial chart;
+  // the name is unique because compile workers and other games can write
+  // the same chart at once
+  std::string temporary = filename + ".XXXXXX";
+  int fd = mkstemp(&temporary[0]);
+  if (fd < 0) return false;
+  FILE* output = fdopen(fd, "wb");
+  if (!output) {
+    close(fd);
+    remove(temporary.c_str());
+    return false;
+  }
+
+  ChartHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHART_MAGIC, sizeof(CHART_MAGIC));
+  header.version = CHART_VERSION;
+  header.headerSize = sizeof(ChartHeader);
+  header.sourceHash = m_sourceHash;
+  header.count = m_count;
+  header.division = m_division;
+  header.tempoCount = (uint32_t)m_tempos.size();
+
+  static const unsigned char padding[8] = { };
+  bool ok = fwrite(&header, sizeof(header), 1, output) == 1;
+  if (m_count) {
+    ok = ok && fwrite(time_us, sizeof(int64_t), m_count, output) == m_count;
+    ok = ok && fwrite(duration_us, sizeof(int64_t), m_count, output) == m_count;
+    ok = ok && fwrite(key, 1, m_count, output) == m_count;
+    ok = ok && fwrite(lane, 1, m_count, output) == m_count;
+    ok = ok && fwrite(channel, 1, m_count, output) == m_count;
+  }
+  size_t pad = roundUp8(m_count * 3) - m_count * 3;
+  if (pad) ok = ok && fwrite(padding, 1, pad, output) == pad;
+  if (!m_tempos.empty()) ok = ok && fwrite(&m_tempos[0], sizeof(ChartTempo), m_tempos.size(), output) == m_tempos.size();
+  ok = (fclose(output) == 0) && ok;
+
+  if (ok && rename(temporary.c_str(), filename.c_str()) == 0) return true;
+  remove(temporary.c_str());
+  if (ok) {
+    // fine if someone else has already put the same chart there
+    NoteChart existing;
+    ok = existing.mapFile(filename, m_sourceHash) && existing.size() == m_count;
+  }
+  return ok;
+}
+
+/*-------------------\
+|---- NoteLinker ----|
+\-------------------*/
+NoteLinker::NoteLinker(void)
+  : m_free(-1)
+{
+  for (int i = 0; i < 16 * 128; i++) m_head[i] = -1;
+}
+
+void NoteLinker::noteOn(uint64_t index, int channel, int key, int64_t time_us)
+{
+  int32_t node = m_free;
+  if (node >= 0) {
+    m_free = m_nodes[node].next;
+  } else {
+    node = (int32_t)m_nodes.size();
+    m_nodes.push_back(Node());
+  }
+  int slot = (channel & 0x0F) * 128 + (key & 0x7F);
+  m_nodes[node].index = index;
+  m_nodes[node].time_us = time_us;
+  m_nodes[node].next = m_head[slot];
+  m_head[slot] = node;
+}
+
+bool NoteLinker::noteOff(int channel, int key, int64_t time_us, uint64_t& index, int64_t& duration_us)
+{
+  int slot = (channel & 0x0F) * 128 + (key & 0x7F);
+  int32_t node = m_head[slot];
+  if (node < 0) return false;
+
+  index = m_nodes[node].index;
+  duration_us = time_us - m_nodes[node].time_us;
+  m_head[slot] = m_nodes[node].next;
+  m_nodes[node].next = m_free;
+  m_free = node;
+  return true;
+}
+
+/*-------------------\
+|---- Compilation ---|
+\-------------------*/
+void compileNoteChart(MidiFile& midifile, NoteChart& chart)
+{
+  std::vector<ChartEntry> entries;
+  std::vector<TempoChange> tempos;
+
+  int tracks = midifile.getTrackCount();
+  for (int track = 0; track < tracks; track++) {
+    for (int event = 0; event < midifile[track].size(); event++) {
+      MidiEvent& midiEvent = midifile[track][event];
+      if (midiEvent.isTempo()) {
+        TempoChange change = { midiEvent.tick, midiEvent.getTempoMicroseconds() };
+        tempos.push_back(change);
+      }
+      if (!midiEvent.isNoteOn()) continue;
+
+      ChartEntry entry;
+      entry.time_us = llround(midiEvent.seconds * 1000000.0);
+      entry.duration_us = llround(midiEvent.getDurationInSeconds() * 1000000.0);
+      entry.key = (uint8_t)midiEvent.getKeyNumber();
+      entry.channel = (uint8_t)midiEvent.getChannel();
+      entries.push_back(entry);
+    }
+  }
+
+  // each track is already in time order, so a stable sort only interleaves
+  // tracks and keeps same-time notes in track order
+  if (tracks > 1) std::stable_sort(entries.begin(), entries.end(), entryBefore);
+  if (tracks > 1) std::stable_sort(tempos.begin(), tempos.end(), tempoBefore);
+
+  uint64_t hash = chart.sourceHash();
+  chart.clear();
+  chart.setSourceHash(hash);
+  chart.setDivision(midifile.getTicksPerQuarterNote());
+  for (size_t i = 0; i < tempos.size(); i++) chart.addTempo(tempos[i].tick, tempos[i].tempo);
+  fillChart(entries, chart);
+}
+
+static double millisecondsSince(const struct timespec& start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+// Time stamp and pair the notes of one track against the song's tempo map.
+static void linkTrack(const EventTrack& track, const TempoMap& tempoMap, std::vector<ChartEntry>& entries)
+{
+  // time stamp every note event of the track in one pass over the tempo map
+  std::vector<int> noteEvents;
+  std::vector<int64_t> ticks;
+  for (int i = 0; i < track.size(); i++) {
+    if (!track[i].isNoteOn() && !track[i].isNoteOff()) continue;
+    noteEvents.push_back(i);
+    ticks.push_back(track[i].tick);
+  }
+  std::vector<int64_t> times(ticks.size());
+  if (!ticks.empty()) tempoMap.toMicros(&ticks[0], &times[0], ticks.size());
+
+  NoteLinker linker;
+  for (size_t n = 0; n < noteEvents.size(); n++) {
+    const CompactEvent& event = track[noteEvents[n]];
+    if (event.isNoteOn()) {
+      ChartEntry entry = { times[n], 0, (uint8_t)event.key(), (uint8_t)event.channel() };
+      linker.noteOn(entries.size(), event.channel(), event.key(), times[n]);
+      entries.push_back(entry);
+    } else {
+      uint64_t index;
+      int64_t duration;
+      if (linker.noteOff(event.channel(), event.key(), times[n], index, duration)) entries[index].duration_us = duration;
+    }
+  }
+}
+
+void compileNoteChart(const EventStore& events, NoteChart& chart, int threads, LoadTimings* timings)
+{
+  struct timespec phase;
+  int tracks = events.getTrackCount();
+
+  // tempo changes can sit in any track, every track needs all of them
+  clock_gettime(CLOCK_MONOTONIC, &phase);
+  std::vector<TempoChange> tempos;
+  for (int track = 0; track < tracks; track++) {
+    for (int i = 0; i < events[track].size(); i++) {
+      const CompactEvent& event = events[track][i];
+      if (!event.isTempo()) continue;
+      TempoChange change = { event.tick, events[track].tempo(event) };
+      tempos.push_back(change);
+    }
+  }
+  std::stable_sort(tempos.begin(), tempos.end(), tempoBefore);
+
+  uint64_t hash = chart.sourceHash();
+  chart.clear();
+  chart.setSourceHash(hash);
+  chart.setDivision(events.getDivision());
+  for (size_t i = 0; i < tempos.size(); i++) chart.addTempo(tempos[i].tick, tempos[i].tempo);
+  const TempoMap& tempoMap = chart.tempoMap();
+  if (timings) timings->tempo_ms = millisecondsSince(phase);
+
+  // tracks are independent once the tempo map is known
+  clock_gettime(CLOCK_MONOTONIC, &phase);
+  std::vector<std::vector<ChartEntry> > trackEntries(tracks);
+  parallelFor(tracks, threads, [&](int track) {
+    linkTrack(events[track], tempoMap, trackEntries[track]);
+  });
+  if (timings) timings->link_ms = millisecondsSince(phase);
+
+  // merge by (time, track) through a min-heap
+  clock_gettime(CLOCK_MONOTONIC, &phase);
+  typedef std::pair<int64_t, int> HeapEntry;
+  std::vector<size_t> cursor(tracks, 0);
+  std::vector<HeapEntry> heap;
+  size_t total = 0;
+  for (int track = 0; track < tracks; track++) {
+    total += trackEntries[track].size();
+    if (!trackEntries[track].empty()) heap.push_back(HeapEntry(trackEntries[track][0].time_us, track));
+  }
+  std::make_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+
+  chart.reserve(total);
+  while (!heap.empty()) {
+    std::pop_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    int track = heap.back().second;
+    heap.pop_back();
+
+    const ChartEntry& entry = trackEntries[track][cursor[track]];
+    chart.push_back(entry.time_us, entry.duration_us, entry.key, entry.key % CHART_LANES, entry.channel);
+    if (++cursor[track] < trackEntries[track].size()) {
+      heap.push_back(HeapEntry(trackEntries[track][cursor[track]].time_us, track));
+      std::push_heap(heap.begin(), heap.end(), std::greater<HeapEntry>());
+    }
+  }
+
+  if (timings) timings->merge_ms = millisecondsSince(phase);
+}
+
+size_t dueNotes(const NoteChart& chart, size_t cursor, int64_t now_us)
+{
+  size_t count = chart.size();
+  while (cursor < count && chart.time_us[cursor] <= now_us) cursor++;
+  return cursor;
+}
@@ -0,0 +1,148 @@
+/* note-chart.h
+
+The note chart is the gameplay view of a MIDI file: every note on, in time
+order, with the MIDI plumbing stripped away.  It is compiled once at load time
+so the game loop only has to walk a cursor forward through a few flat arrays.
+
+A chart lives in one block of memory laid out exactly like a chart file on
+disk (see chart-cache.h), so a cached chart can be mmap'ed and played as is.
+*/
+
+#ifndef _NOTE_CHART_H_INCLUDED
+#define _NOTE_CHART_H_INCLUDED
+
+#include "MidiFile.h"
+#include "event-store.h"
+#include "tempo-map.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Constants */
+const unsigned int CHART_LANES = 4;
+const uint32_t CHART_VERSION = 6;
+
+/* Structs */
+// Fixed size header at the start of every chart image.
+struct ChartHeader {
+  char     magic[8];     // "THCHART"
+  uint32_t version;      // CHART_VERSION
+  uint32_t headerSize;   // sizeof(ChartHeader)
+  uint64_t sourceHash;   // hash of the MIDI file bytes the chart came from
+  uint64_t count;        // number of notes
+  int32_t  division;     // MIDI file division, see TempoMap::reset()
+  uint32_t tempoCount;   // tempo changes stored after the note columns
+};
+
+// Tempo change as stored in a chart file.
+struct ChartTempo {
+  int64_t tick;
+  int64_t microsecondsPerQuarter;
+};
+
+// Struct of arrays, index i of every column describes the same note.  The
+// columns point into the chart image and are only valid while it is alive.
+// The chart also carries the song's tempo map, so the scroll speed can
+// follow it without the MIDI file.
+class NoteChart {
+  public:
+    NoteChart(void);
+    ~NoteChart();
+
+    const int64_t* time_us;      // note on, microseconds from song start
+    const int64_t* duration_us;  // microseconds until the matching note off
+    const uint8_t* key;          // MIDI key number
+    const uint8_t* lane;         // key % CHART_LANES, the game uses lane-map.h instead
+    const uint8_t* channel;      // MIDI channel, so the game can pick a part
+
+    size_t size(void) const { return m_count; }
+    size_t capacity(void) const { return m_capacity; }
+    uint64_t sourceHash(void) const { return m_sourceHash; }
+    bool isMapped(void) const { return m_map != NULL; }
+
+    void clear(void);
+    void reserve(size_t capacity);
+    void push_back(int64_t time, int64_t duration, uint8_t noteKey, uint8_t noteLane, uint8_t noteChannel);
+    void setDuration(size_t index, int64_t duration);
+    void setSourceHash(uint64_t hash) { m_sourceHash = hash; }
+
+    // tempo changes must be added in tick order, after setDivision()
+    const TempoMap& tempoMap(void) const { return m_tempoMap; }
+    int division(void) const { return m_division; }
+    void setDivision(int division);
+    void addTempo(int64_t tick, int microsecondsPerQuarter);
+
+    // chart files, mapFile() fails if the file is stale or was not written
+    // from a source with the given hash
+    bool mapFile(const std::string& filename, uint64_t hash);
+    bool writeFile(const std::string& filename) const;
+
+  private:
+    NoteChart(const NoteChart&);
+    NoteChart& operator=(const NoteChart&);
+
+    void layout(unsigned char* base, size_t capacity);
+    void unmap(void);
+
+    std::vector<uint64_t> m_heap;  // uint64_t keeps the image 8 byte aligned
+    std::vector<ChartTempo> m_tempos;
+    TempoMap m_tempoMap;
+    int      m_division;
+    void*    m_map;
+    size_t   m_mapLength;
+    size_t   m_count;
+    size_t   m_capacity;
+    uint64_t m_sourceHash;
+};
+
+// Time spent in each phase of compiling a chart from an EventStore.
+struct LoadTimings {
+  double decode_ms;  // EventStore::read, filled in by the caller
+  double tempo_ms;   // collecting tempo changes from every track
+  double link_ms;    // per track time stamping and note pairing
+  double merge_ms;   // merging the tracks into the chart
+};
+
+// Pairs note offs with the newest sounding note on of the same channel and
+// key, the same way MidiFile::linkNotePairs() does.  Sounding notes are kept
+// in one stack per channel and key, threaded through a single node array.
+class NoteLinker {
+  public:
+    NoteLinker(void);
+
+    void noteOn(uint64_t index, int channel, int key, int64_t time_us);
+
+    // false if no note is sounding on that channel and key
+    bool noteOff(int channel, int key, int64_t time_us, uint64_t& index, int64_t& duration_us);
+
+  private:
+    struct Node {
+      uint64_t index;
+      int64_t  time_us;
+      int32_t  next;
+    };
+
+    int32_t           m_head[16 * 128];  // newest sounding note, -1 for none
+    std::vector<Node> m_nodes;
+    int32_t           m_free;
+};
+
+/* Function References */
+// Expects doTimeAnalysis() and linkNotePairs() to have been run.  Works on
+// joined or split tracks; notes from different tracks are merged by time.
+void compileNoteChart(smf::MidiFile& midifile, NoteChart& chart);
+
+// Same chart, compiled from the compact event store.  Tracks are time
+// stamped and note paired on up to threads threads and then merged.
+void compileNoteChart(const EventStore& events, NoteChart& chart,
+                      int threads = 1, LoadTimings* timings = NULL);
+
+// Index one past the last note at or before now_us, starting from cursor.
+size_t dueNotes(const NoteChart& chart, size_t cursor, int64_t now_us);
+
+// Bytes needed for a chart image holding count notes.
+size_t chartImageSize(size_t count);
+
+#endif /* _NOTE_CHART_H_INCLUDED */
@@ -0,0 +1,158 @@
+/* offline-render.cpp
+
+Driverless synth rendering and WAV output.
+*/
+#include "offline-render.h"
+
+#include <fluidsynth.h>
+#include <stdio.h>
+#include <time.h>
+
+// frames pulled from the synth per fluid_synth_write_s16() call at most
+static const int RENDER_BLOCK = 4096;
+
+static double millisSince(const struct timespec& start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+// Same mapping as BackingTrack::send(), straight into the synth.
+static void applyEvent(fluid_synth_t* synth, const BackingEvent& event)
+{
+  int channel = event.status & 0x0F;
+  switch (event.status & 0xF0) {
+  case 0x80:
+    fluid_synth_noteoff(synth, channel, event.data1);
+    break;
+  case 0x90:
+    if (event.data2) fluid_synth_noteon(synth, channel, event.data1, event.data2);
+    else fluid_synth_noteoff(synth, channel, event.data1);
+    break;
+  case 0xA0:
+    fluid_synth_key_pressure(synth, channel, event.data1, event.data2);
+    break;
+  case 0xB0:
+    fluid_synth_cc(synth, channel, event.data1, event.data2);
+    break;
+  case 0xC0:
+    fluid_synth_program_change(synth, channel, event.data1);
+    break;
+  case 0xD0:
+    fluid_synth_channel_pressure(synth, channel, event.data1);
+    break;
+  case 0xE0:
+    fluid_synth_pitch_bend(synth, channel, event.data2 << 7 | event.data1);
+    break;
+  default:
+    break;
+  }
+}
+
+// Pull frames frames of interleaved stereo out of synth.
+static void renderFrames(fluid_synth_t* synth, int64_t frames, std::vector<int16_t>* samples,
+                         std::vector<int16_t>& block)
+{
+  while (frames > 0) {
+    int length = frames < RENDER_BLOCK ? (int)frames : RENDER_BLOCK;
+    int16_t* out = &block[0];
+    if (samples) {
+      size_t used = samples->size();
+      samples->resize(used + 2 * length);
+      out = &(*samples)[used];
+    }
+    fluid_synth_write_s16(synth, length, out, 0, 2, out, 1, 2);
+    frames -= length;
+  }
+}
+
+bool renderOffline(const std::vector<BackingEvent>& events, const std::string& soundfont,
+                   int sampleRate, std::vector<int16_t>* samples, RenderStats& stats)
+{
+  stats.frames = 0;
+  stats.load_ms = 0;
+  stats.render_ms = 0;
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  fluid_settings_t* settings = new_fluid_settings();
+  if (!settings) return false;
+  fluid_settings_setnum(settings, "synth.sample-rate", sampleRate);
+  // nobody else touches this synth, skip the API lock
+  fluid_settings_setint(settings, "synth.threadsafe-api", 0);
+  fluid_synth_t* synth = new_fluid_synth(settings);
+  if (!synth || fluid_synth_sfload(synth, soundfont.c_str(), 1) == FLUID_FAILED) {
+    if (synth) delete_fluid_synth(synth);
+    delete_fluid_settings(settings);
+    return false;
+  }
+  stats.load_ms = millisSince(start);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int64_t end_us = (events.empty() ? 0 : events.back().time_us) + RENDER_TAIL_US;
+  int64_t totalFrames = end_us * sampleRate / 1000000;
+  if (samples) samples->reserve(samples->size() + 2 * totalFrames);
+  std::vector<int16_t> block(2 * RENDER_BLOCK);
+
+  // render up to each event's frame, then apply it
+  int64_t frame = 0;
+  for (size_t i = 0; i < events.size(); i++) {
+    int64_t eventFrame = (events[i].time_us > 0 ? events[i].time_us : 0) * sampleRate / 1000000;
+    if (eventFrame > frame) {
+      renderFrames(synth, eventFrame - frame, samples, block);
+      frame = eventFrame;
+    }
+    applyEvent(synth, events[i]);
+  }
+  if (totalFrames > frame) {
+    renderFrames(synth, totalFrames - frame, samples, block);
+    frame = totalFrames;
+  }
+  stats.frames = frame;
+  stats.render_ms = millisSince(start);
+
+  delete_fluid_synth(synth);
+  delete_fluid_settings(settings);
+  return true;
+}
+
+static void putLittleEndian(FILE* output, uint32_t value, int bytes)
+{
+  for (int i = 0; i < bytes; i++) fputc((value >> (8 * i)) & 0xFF, output);
+}
+
+bool writeWavFile(const std::string& filename, const std::vector<int16_t>& samples, int sampleRate, int channels)
+{
+  FILE* output = fopen(filename.c_str(), "wb");
+  if (!output) return false;
+
+  uint32_t dataBytes = (uint32_t)(samples.size() * 2);
+  fwrite("RIFF", 1, 4, output);
+  putLittleEndian(output, 36 + dataBytes, 4);
+  fwrite("WAVEfmt ", 1, 8, output);
+  putLittleEndian(output, 16, 4);                         // fmt chunk size
+  putLittleEndian(output, 1, 2);                          // PCM
+  putLittleEndian(output, channels, 2);
+  putLittleEndian(output, sampleRate, 4);
+  putLittleEndian(output, sampleRate * channels * 2, 4);  // bytes per second
+  putLittleEndian(output, channels * 2, 2);               // bytes per frame
+  putLittleEndian(output, 16, 2);                         // bits per sample
+  fwrite("data", 1, 4, output);
+  putLittleEndian(output, dataBytes, 4);
+
+  // samples are written little endian whatever the host order is
+  unsigned char buffer[8192];
+  size_t used = 0;
+  bool ok = true;
+  for (size_t i = 0; ok && i < samples.size(); i++) {
+    uint16_t sample = (uint16_t)samples[i];
+    buffer[used++] = sample & 0xFF;
+    buffer[used++] = sample >> 8;
+    if (used == sizeof(buffer) || i + 1 == samples.size()) {
+      ok = fwrite(buffer, 1, used, output) == used;
+      used = 0;
+    }
+  }
+  return fclose(output) == 0 && ok;
+}
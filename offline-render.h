@@ -0,0 +1,43 @@
+/* offline-render.h
+
+Offline rendering.  A song's decoded channel events are played into a synth
+that has no audio driver, pulling samples with fluid_synth_write_s16() as
+fast as the CPU allows.  Every event is applied on its exact sample frame:
+the synth is rendered up to it, the event goes in, and rendering carries on.
+
+Each render owns its settings and synth, so several can run at once.
+*/
+
+#ifndef _OFFLINE_RENDER_H_INCLUDED
+#define _OFFLINE_RENDER_H_INCLUDED
+
+#include "backing-track.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Constants */
+const int RENDER_SAMPLE_RATE = 44100;
+// rendered after the last event so releases and reverb can ring out
+const int64_t RENDER_TAIL_US = 2000000;
+
+/* Structs */
+struct RenderStats {
+  uint64_t frames;     // stereo sample frames rendered
+  double   load_ms;    // creating the synth and loading the soundfont
+  double   render_ms;  // pulling samples, the real-time factor is based on this
+};
+
+/* Function References */
+// Render events (time ordered, see BackingTrack::events()) through a fresh
+// synth with soundfont loaded.  Interleaved stereo samples are appended to
+// samples, or thrown away block by block when it is NULL.
+bool renderOffline(const std::vector<BackingEvent>& events, const std::string& soundfont,
+                   int sampleRate, std::vector<int16_t>* samples, RenderStats& stats);
+
+// 16 bit PCM RIFF/WAVE file of interleaved samples.
+bool writeWavFile(const std::string& filename, const std::vector<int16_t>& samples, int sampleRate, int channels = 2);
+
+#endif /* _OFFLINE_RENDER_H_INCLUDED */
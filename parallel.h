@@ -0,0 +1,116 @@
+/* parallel.h
+
+Tiny helpers for spreading independent work items over a few threads.
+*/
+
+#ifndef _PARALLEL_H_INCLUDED
+#define _PARALLEL_H_INCLUDED
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Number of worker threads to use when the caller asked for "all of them".
+inline int hardwareThreads(void)
+{
+  unsigned int count = std::thread::hardware_concurrency();
+  return count ? (int)count : 1;
+}
+
+// Call work(i) for every i in [0, count) on up to threads threads.  Items
+// are handed out one at a time, so uneven items balance themselves.  With one
+// thread (or one item) everything runs on the calling thread.
+template <typename Work>
+void parallelFor(int count, int threads, Work work)
+{
+  if (threads > count) threads = count;
+  if (threads <= 1) {
+    for (int i = 0; i < count; i++) work(i);
+    return;
+  }
+
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++) {
+    workers.push_back(std::thread([&]() {
+      for (int i = next++; i < count; i = next++) work(i);
+    }));
+  }
+  for (int i = next++; i < count; i = next++) work(i);
+  for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+}
+
+// Call work(i, worker) for every i in [0, count) on up to threads threads,
+// worker being 0 .. threads - 1 so it can keep per-thread state.  Each
+// worker starts with an even slice of the range and walks it front to back,
+// keeping neighbouring items on one thread; a worker that runs dry steals the
+// back half of the largest slice left.  Returns the number of steals.
+template <typename Work>
+int parallelForStealing(int count, int threads, Work work)
+{
+  if (threads > count) threads = count;
+  if (threads <= 1) {
+    for (int i = 0; i < count; i++) work(i, 0);
+    return 0;
+  }
+
+  struct Slice {
+    std::mutex lock;
+    int        begin;
+    int        end;
+  };
+  std::vector<Slice> slices(threads);
+  for (int t = 0; t < threads; t++) {
+    slices[t].begin = (int)((long long)count * t / threads);
+    slices[t].end = (int)((long long)count * (t + 1) / threads);
+  }
+
+  std::atomic<int> steals(0);
+  auto run = [&](int worker) {
+    Slice& own = slices[worker];
+    for (;;) {
+      int item = -1;
+      {
+        std::lock_guard<std::mutex> hold(own.lock);
+        if (own.begin < own.end) item = own.begin++;
+      }
+      if (item >= 0) {
+        work(item, worker);
+        continue;
+      }
+
+      int victim = -1;
+      int most = 0;
+      for (int t = 0; t < threads; t++) {
+        if (t == worker) continue;
+        std::lock_guard<std::mutex> hold(slices[t].lock);
+        if (slices[t].end - slices[t].begin > most) {
+          most = slices[t].end - slices[t].begin;
+          victim = t;
+        }
+      }
+      // nothing left anywhere, and nobody adds work
+      if (victim < 0) return;
+
+      std::lock(own.lock, slices[victim].lock);
+      std::lock_guard<std::mutex> holdOwn(own.lock, std::adopt_lock);
+      std::lock_guard<std::mutex> holdVictim(slices[victim].lock, std::adopt_lock);
+      int left = slices[victim].end - slices[victim].begin;
+      if (left <= 0) continue;
+      int take = (left + 1) / 2;
+      own.begin = slices[victim].end - take;
+      own.end = slices[victim].end;
+      slices[victim].end -= take;
+      steals++;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int t = 1; t < threads; t++) workers.push_back(std::thread(run, t));
+  run(0);
+  for (size_t t = 0; t < workers.size(); t++) workers[t].join();
+  return steals;
+}
+
+#endif /* _PARALLEL_H_INCLUDED */
@@ -0,0 +1,55 @@
+/* scroll-scheduler.cpp
+
+Tempo-following row scheduler.
+*/
+#include "scroll-scheduler.h"
+
+ScrollScheduler::ScrollScheduler(const TempoMap& tempoMap, int rowsPerQuarter)
+  : m_tempoMap(&tempoMap), m_rowsPerQuarter(rowsPerQuarter > 0 ? rowsPerQuarter : 1)
+{
+  reset();
+}
+
+void ScrollScheduler::reset(void)
+{
+  // row 0 is the start of the song, the first scroll happens one row in
+  m_row = 0;
+  m_currentRowTime = 0;
+  m_nextRowTime = rowTime(1);
+}
+
+int64_t ScrollScheduler::rowTime(int64_t row) const
+{
+  return m_tempoMap->quarterToMicros(row, m_rowsPerQuarter);
+}
+
+int64_t ScrollScheduler::advance(void)
+{
+  m_row++;
+  m_currentRowTime = m_nextRowTime;
+  // computed from the tempo map every time, never by adding periods up
+  m_nextRowTime = rowTime(m_row + 1);
+  return m_currentRowTime;
+}
+
+int64_t delayedTickTime(const TempoMap& tempoMap, int64_t tick, int delayRows, int rowsPerQuarter)
+{
+  if (tempoMap.isSmpte()) return tempoMap.toMicros(tick) + tempoMap.quarterToMicros(delayRows, rowsPerQuarter);
+  int64_t ticksPerQuarter = tempoMap.ticksPerQuarter();
+  return tempoMap.quarterToMicros(tick * rowsPerQuarter + delayRows * ticksPerQuarter, ticksPerQuarter * rowsPerQuarter);
+}
+
+int64_t noteRow(const TempoMap& tempoMap, int64_t time_us, int rowsPerQuarter)
+{
+  if (tempoMap.isSmpte()) return time_us / tempoMap.quarterToMicros(1, rowsPerQuarter);
+  // a microsecond later for the same reason as in noteHitTime()
+  return tempoMap.toTick(time_us + 1) * rowsPerQuarter / tempoMap.ticksPerQuarter();
+}
+
+int64_t noteHitTime(const TempoMap& tempoMap, int64_t time_us, int delayRows, int rowsPerQuarter)
+{
+  if (tempoMap.isSmpte()) return time_us + tempoMap.quarterToMicros(delayRows, rowsPerQuarter);
+  // chart times are rounded to the microsecond, a tick is far longer than
+  // one, so the microsecond after the note is still on the note's tick
+  return delayedTickTime(tempoMap, tempoMap.toTick(time_us + 1), delayRows, rowsPerQuarter);
+}
@@ -0,0 +1,64 @@
+/* scroll-scheduler.h
+
+Decides when the board scrolls.  One row of the board is a 16th note, so the
+row period follows the song's tempo map instead of a single BPM.  Every row
+deadline is computed from the tempo map directly rather than by adding up
+periods, so timing error never accumulates over a song.
+*/
+
+#ifndef _SCROLL_SCHEDULER_H_INCLUDED
+#define _SCROLL_SCHEDULER_H_INCLUDED
+
+#include "tempo-map.h"
+
+#include <stdint.h>
+
+/* Constants */
+const int ROWS_PER_QUARTER = 4;  // 16th notes
+// notes spawn once the clock is within this many microseconds of them
+const int64_t SPAWN_SLACK_US = 50;
+
+class ScrollScheduler {
+  public:
+    // The tempo map must outlive the scheduler; it may keep growing while
+    // the song streams in.
+    explicit ScrollScheduler(const TempoMap& tempoMap, int rowsPerQuarter = ROWS_PER_QUARTER);
+
+    // Song time, in microseconds, at which row starts.
+    int64_t rowTime(int64_t row) const;
+
+    // Go back to the start of the song, call after the tempo map is loaded.
+    void reset(void);
+
+    // Rows started so far, when the last one started and when the next one
+    // is due.
+    int64_t row(void) const { return m_row; }
+    int64_t currentRowTime(void) const { return m_currentRowTime; }
+    int64_t nextRowTime(void) const { return m_nextRowTime; }
+    bool due(int64_t now_us) const { return now_us >= m_nextRowTime; }
+
+    // Start the next row, returning its scheduled time.
+    int64_t advance(void);
+
+  private:
+    const TempoMap* m_tempoMap;
+    int             m_rowsPerQuarter;
+    int64_t         m_row;
+    int64_t         m_currentRowTime;
+    int64_t         m_nextRowTime;
+};
+
+/* Function References */
+// Time of the musical position delayRows rows after tick, exact between
+// ticks.  SMPTE songs have no quarter notes and are delayed by a fixed time.
+int64_t delayedTickTime(const TempoMap& tempoMap, int64_t tick, int delayRows, int rowsPerQuarter = ROWS_PER_QUARTER);
+
+// Board row a note at time_us starts in, the 16th note it falls on.
+int64_t noteRow(const TempoMap& tempoMap, int64_t time_us, int rowsPerQuarter = ROWS_PER_QUARTER);
+
+// When a note at time_us should be hit on a board delayRows rows tall: its
+// own position delayRows rows later, the delay the backing track plays
+// with, rather than the row it happened to scroll in on.
+int64_t noteHitTime(const TempoMap& tempoMap, int64_t time_us, int delayRows, int rowsPerQuarter = ROWS_PER_QUARTER);
+
+#endif /* _SCROLL_SCHEDULER_H_INCLUDED */
@@ -0,0 +1,125 @@
+/* smf-decoder.cpp
+
+Standard MIDI File chunk and event decoding.
+*/
+#include "smf-decoder.h"
+
+#include <string.h>
+
+static uint32_t readBigEndian(const unsigned char* p, int bytes)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < bytes; i++) value = (value << 8) | p[i];
+  return value;
+}
+
+bool readSmfLayout(const unsigned char* bytes, size_t length, SmfLayout& layout)
+{
+  layout.tracks.clear();
+  if (length < 14 || memcmp(bytes, "MThd", 4) != 0) return false;
+
+  uint32_t headerLength = readBigEndian(bytes + 4, 4);
+  if (headerLength < 6 || 8 + (size_t)headerLength > length) return false;
+  layout.format = (int)readBigEndian(bytes + 8, 2);
+  int trackCount = (int)readBigEndian(bytes + 10, 2);
+  layout.division = (int)(int16_t)readBigEndian(bytes + 12, 2);
+
+  size_t position = 8 + headerLength;
+  while (position + 8 <= length && (int)layout.tracks.size() < trackCount) {
+    uint32_t chunkLength = readBigEndian(bytes + position + 4, 4);
+    const unsigned char* chunkData = bytes + position + 8;
+    size_t available = length - position - 8;
+    if (memcmp(bytes + position, "MTrk", 4) == 0) {
+      // a truncated last chunk is played as far as it goes
+      SmfTrackChunk chunk = { chunkData, chunkLength < available ? chunkLength : available };
+      layout.tracks.push_back(chunk);
+    }
+    if (chunkLength >= available) break;
+    position += 8 + chunkLength;
+  }
+
+  return !layout.tracks.empty();
+}
+
+/*-------------------\
+|- SmfTrackDecoder --|
+\-------------------*/
+SmfTrackDecoder::SmfTrackDecoder(void)
+  : m_position(NULL), m_end(NULL), m_tick(0), m_runningStatus(0), m_corrupt(false)
+{
+}
+
+SmfTrackDecoder::SmfTrackDecoder(const SmfTrackChunk& chunk)
+{
+  reset(chunk);
+}
+
+void SmfTrackDecoder::reset(const SmfTrackChunk& chunk)
+{
+  m_position = chunk.data;
+  m_end = chunk.data + chunk.length;
+  m_tick = 0;
+  m_runningStatus = 0;
+  m_corrupt = false;
+}
+
+bool SmfTrackDecoder::readVariableLength(uint32_t& value)
+{
+  value = 0;
+  for (int i = 0; i < 4; i++) {
+    if (m_position >= m_end) return false;
+    uint8_t byte = *m_position++;
+    value = (value << 7) | (byte & 0x7F);
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+bool SmfTrackDecoder::next(SmfEvent& event)
+{
+  if (m_position >= m_end || m_corrupt) return false;
+
+  uint32_t delta;
+  if (!readVariableLength(delta) || m_position >= m_end) {
+    m_corrupt = m_position < m_end;
+    return false;
+  }
+  m_tick += delta;
+  event.tick = m_tick;
+  event.metaType = 0;
+
+  uint8_t status = *m_position;
+  if (status & 0x80) {
+    m_position++;
+  } else if (m_runningStatus) {
+    status = m_runningStatus;
+  } else {
+    m_corrupt = true;
+    return false;
+  }
+  event.status = status;
+
+  uint32_t length;
+  if (status == SMF_META) {
+    if (m_position >= m_end) { m_corrupt = true; return false; }
+    event.metaType = *m_position++;
+    if (!readVariableLength(length)) { m_corrupt = true; return false; }
+    if (event.metaType == SMF_META_END_OF_TRACK) m_end = m_position + length;
+  } else if (status == 0xF0 || status == 0xF7) {
+    m_runningStatus = 0;
+    if (!readVariableLength(length)) { m_corrupt = true; return false; }
+  } else {
+    m_runningStatus = status;
+    uint8_t command = status & 0xF0;
+    length = (command == 0xC0 || command == 0xD0) ? 1 : 2;
+  }
+
+  if ((size_t)(m_end - m_position) < length) {
+    m_corrupt = true;
+    return false;
+  }
+  event.data = m_position;
+  event.length = length;
+  m_position += length;
+  return true;
+}
@@ -0,0 +1,89 @@
+/* smf-decoder.h
+
+A minimal, allocation free decoder for Standard MIDI File bytes.  It splits a
+file into its track chunks and walks one chunk an event at a time, for loaders
+that want to work on raw tracks instead of a fully built smf::MidiFile.
+*/
+
+#ifndef _SMF_DECODER_H_INCLUDED
+#define _SMF_DECODER_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/* Constants */
+const uint8_t SMF_META = 0xFF;
+const uint8_t SMF_META_TEMPO = 0x51;
+const uint8_t SMF_META_END_OF_TRACK = 0x2F;
+const int SMF_DEFAULT_TEMPO = 500000;  // microseconds per quarter note, 120 BPM
+
+/* Structs */
+struct SmfTrackChunk {
+  const unsigned char* data;
+  size_t length;
+};
+
+struct SmfLayout {
+  int format;
+  int division;  // ticks per quarter note, or negative SMPTE frames (see TempoMap)
+  std::vector<SmfTrackChunk> tracks;
+};
+
+struct SmfEvent {
+  int64_t tick;                // absolute tick from the start of the track
+  uint8_t status;              // channel status byte, 0xF0/0xF7 sysex or SMF_META
+  uint8_t metaType;            // meta events only
+  const unsigned char* data;   // data bytes, not including status or lengths
+  uint32_t length;
+};
+
+// Walks one MTrk chunk.  Running status is expanded, so every channel event
+// reports its full status byte.
+class SmfTrackDecoder {
+  public:
+    SmfTrackDecoder(void);
+    explicit SmfTrackDecoder(const SmfTrackChunk& chunk);
+
+    void reset(const SmfTrackChunk& chunk);
+
+    // false at the end of the track or if the chunk is corrupt
+    bool next(SmfEvent& event);
+    bool corrupt(void) const { return m_corrupt; }
+
+  private:
+    bool readVariableLength(uint32_t& value);
+
+    const unsigned char* m_position;
+    const unsigned char* m_end;
+    int64_t m_tick;
+    uint8_t m_runningStatus;
+    bool    m_corrupt;
+};
+
+/* Function References */
+// Parse the header and locate every MTrk chunk.  Unknown chunks are skipped.
+bool readSmfLayout(const unsigned char* bytes, size_t length, SmfLayout& layout);
+
+// Channel message helpers.
+inline bool isSmfNoteOn(const SmfEvent& e)
+{
+  return (e.status & 0xF0) == 0x90 && e.length >= 2 && e.data[1] > 0;
+}
+
+inline bool isSmfNoteOff(const SmfEvent& e)
+{
+  return e.length >= 2 && ((e.status & 0xF0) == 0x80 || ((e.status & 0xF0) == 0x90 && e.data[1] == 0));
+}
+
+inline bool isSmfTempo(const SmfEvent& e)
+{
+  return e.status == SMF_META && e.metaType == SMF_META_TEMPO && e.length >= 3;
+}
+
+inline int smfTempo(const SmfEvent& e)
+{
+  return (e.data[0] << 16) | (e.data[1] << 8) | e.data[2];
+}
+
+#endif /* _SMF_DECODER_H_INCLUDED */
@@ -0,0 +1,287 @@
+/* song-library.cpp
+
+Directory walking and the song index.
+*/
+#include "song-library.h"
+#include "chart-cache.h"
+#include "event-store.h"
+#include "note-chart.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <unordered_map>
+
+static const char SONG_INDEX_MAGIC[8] = "THINDEX";
+static const int64_t PEAK_WINDOW_US = 1000000;
+
+bool isMidiFileName(const std::string& name)
+{
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos) return false;
+  const char* extension = name.c_str() + dot + 1;
+  return strcasecmp(extension, "mid") == 0 || strcasecmp(extension, "midi") == 0;
+}
+
+// depth first, no order within a directory
+static bool walk(const std::string& directory, std::vector<std::string>& files)
+{
+  DIR* listing = opendir(directory.c_str());
+  if (!listing) return false;
+
+  struct dirent* entry;
+  while ((entry = readdir(listing)) != NULL) {
+    std::string name = entry->d_name;
+    if (name == "." || name == "..") continue;
+    std::string path = directory + "/" + name;
+
+    bool isDirectory = entry->d_type == DT_DIR;
+    bool isFile = entry->d_type == DT_REG;
+    // some filesystems do not fill in d_type, and links need following
+    if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+      struct stat info;
+      if (stat(path.c_str(), &info) != 0) continue;
+      isDirectory = S_ISDIR(info.st_mode);
+      isFile = S_ISREG(info.st_mode);
+      // a linked directory could lead back up the tree
+      if (entry->d_type == DT_LNK && isDirectory) continue;
+    }
+
+    if (isDirectory) walk(path, files);
+    else if (isFile && isMidiFileName(name)) files.push_back(path);
+  }
+  closedir(listing);
+  return true;
+}
+
+bool findMidiFiles(const std::string& path, std::vector<std::string>& files)
+{
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) return false;
+  if (!S_ISDIR(info.st_mode)) {
+    files.push_back(path);
+    return true;
+  }
+
+  size_t first = files.size();
+  std::string root = path;
+  while (root.size() > 1 && root[root.size() - 1] == '/') root.erase(root.size() - 1);
+  if (!walk(root, files)) return false;
+  std::sort(files.begin() + first, files.end());
+  return true;
+}
+
+// The absolute path of root without links, dots or a trailing slash, so a
+// library spelled differently is still the same index with the same keys.
+static std::string canonicalRoot(const std::string& root)
+{
+  char resolved[PATH_MAX];
+  return realpath(root.c_str(), resolved) ? resolved : root;
+}
+
+std::string songIndexPath(const std::string& root)
+{
+  std::string directory = cacheDirectory();
+  if (directory.empty()) return "";
+
+  // one index per library, named after where it is
+  std::string where = canonicalRoot(root);
+  char name[48];
+  snprintf(name, sizeof(name), "/library-%016llx.index", (unsigned long long)hashBytes(where.data(), where.size()));
+  return directory + name;
+}
+
+bool readSongInfo(const std::string& filename, SongInfo& info)
+{
+  info.flags = SONG_UNREADABLE;
+  info.duration_us = 0;
+  info.tracks = 0;
+  info.division = 0;
+  info.notes = 0;
+  info.peakNotesPerSecond = 0;
+  info.slowestTempo = info.fastestTempo = 0;
+
+  std::string bytes;
+  EventStore events;
+  if (!readFileBytes(filename, bytes) || !events.read((const unsigned char*)bytes.data(), bytes.size())) return false;
+  NoteChart chart;
+  compileNoteChart(events, chart);
+
+  // the song ends with its last event, usually an end of track
+  int64_t lastTick = 0;
+  for (int track = 0; track < events.getTrackCount(); track++) {
+    int count = events[track].size();
+    if (count && events[track][count - 1].tick > lastTick) lastTick = events[track][count - 1].tick;
+  }
+  const TempoMap& tempoMap = chart.tempoMap();
+  info.duration_us = tempoMap.toMicros(lastTick);
+  info.tracks = events.getTrackCount();
+  info.division = events.getDivision();
+  info.notes = (uint32_t)chart.size();
+
+  info.slowestTempo = info.fastestTempo = tempoMap.tempoAt(0);
+  for (size_t segment = 1; segment < tempoMap.segmentCount(); segment++) {
+    uint32_t tempo = tempoMap.tempoAt(tempoMap.segmentTick(segment));
+    if (tempo > info.slowestTempo) info.slowestTempo = tempo;
+    if (tempo < info.fastestTempo) info.fastestTempo = tempo;
+  }
+
+  // note ons are in time order, slide a one second window over them
+  size_t first = 0;
+  for (size_t last = 0; last < chart.size(); last++) {
+    while (chart.time_us[last] - chart.time_us[first] >= PEAK_WINDOW_US) first++;
+    if (last - first + 1 > info.peakNotesPerSecond) info.peakNotesPerSecond = (uint32_t)(last - first + 1);
+  }
+
+  info.flags = 0;
+  return true;
+}
+
+/*-------------------\
+|----- SongIndex ----|
+\-------------------*/
+bool SongIndex::load(const std::string& filename)
+{
+  m_songs.clear();
+  m_paths.clear();
+  FILE* input = fopen(filename.c_str(), "rb");
+  if (!input) return false;
+
+  SongIndexHeader header;
+  bool ok = fread(&header, sizeof(header), 1, input) == 1 &&
+            memcmp(header.magic, SONG_INDEX_MAGIC, sizeof(SONG_INDEX_MAGIC)) == 0 &&
+            header.version == SONG_INDEX_VERSION &&
+            header.headerSize == sizeof(SongIndexHeader);
+  if (ok) {
+    m_songs.resize(header.count);
+    m_paths.resize(header.pathBytes);
+    ok = (header.count == 0 || fread(&m_songs[0], sizeof(SongInfo), header.count, input) == header.count) &&
+         (header.pathBytes == 0 || fread(&m_paths[0], 1, header.pathBytes, input) == header.pathBytes);
+  }
+  fclose(input);
+
+  // every path must lie inside the table, NUL terminated
+  for (size_t song = 0; ok && song < m_songs.size(); song++) {
+    ok = m_songs[song].path < m_paths.size() && memchr(&m_paths[m_songs[song].path], 0, m_paths.size() - m_songs[song].path);
+  }
+  if (!ok) {
+    m_songs.clear();
+    m_paths.clear();
+  }
+  return ok;
+}
+
+bool SongIndex::save(const std::string& filename) const
+{
+  // write to a unique temporary and rename so a reader never sees half an
+  // index, and two listings of the same library never share a temporary
+  std::string temporary = filename + ".XXXXXX";
+  int fd = mkstemp(&temporary[0]);
+  if (fd < 0) return false;
+  FILE* output = fdopen(fd, "wb");
+  if (!output) {
+    close(fd);
+    remove(temporary.c_str());
+    return false;
+  }
+
+  SongIndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SONG_INDEX_MAGIC, sizeof(SONG_INDEX_MAGIC));
+  header.version = SONG_INDEX_VERSION;
+  header.headerSize = sizeof(SongIndexHeader);
+  header.count = m_songs.size();
+  header.pathBytes = m_paths.size();
+
+  bool ok = fwrite(&header, sizeof(header), 1, output) == 1;
+  if (!m_songs.empty()) ok = ok && fwrite(&m_songs[0], sizeof(SongInfo), m_songs.size(), output) == m_songs.size();
+  if (!m_paths.empty()) ok = ok && fwrite(&m_paths[0], 1, m_paths.size(), output) == m_paths.size();
+  ok = (fclose(output) == 0) && ok;
+
+  if (ok) ok = rename(temporary.c_str(), filename.c_str()) == 0;
+  if (!ok) remove(temporary.c_str());
+  return ok;
+}
+
+static double millisecondsSince(const struct timespec& start)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) * 1000.0 + (now.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+bool SongIndex::update(const std::string& root, int threads, SongIndexStats* stats)
+{
+  struct timespec phase;
+  clock_gettime(CLOCK_MONOTONIC, &phase);
+  std::vector<std::string> files;
+  if (!findMidiFiles(canonicalRoot(root), files)) return false;
+
+  std::unordered_map<std::string, size_t> known;
+  known.reserve(m_songs.size());
+  for (size_t song = 0; song < m_songs.size(); song++) known[path(song)] = song;
+
+  // stat everything, a file whose time and size are unchanged keeps its entry
+  enum { KEPT, CHANGED, ADDED };
+  std::vector<SongInfo> songs(files.size());
+  std::vector<char> state(files.size(), KEPT);
+  parallelFor((int)files.size(), threads, [&](int file) {
+    struct stat info;
+    SongInfo& song = songs[file];
+    memset(&song, 0, sizeof(song));
+    if (stat(files[file].c_str(), &info) == 0) {
+#ifdef __APPLE__
+      song.mtime_ns = (int64_t)info.st_mtimespec.tv_sec * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+      song.mtime_ns = (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+#endif
+      song.fileSize = (uint64_t)info.st_size;
+    }
+    std::unordered_map<std::string, size_t>::const_iterator old = known.find(files[file]);
+    if (old == known.end()) {
+      state[file] = ADDED;
+    } else if (m_songs[old->second].mtime_ns == song.mtime_ns && m_songs[old->second].fileSize == song.fileSize) {
+      song = m_songs[old->second];
+    } else {
+      state[file] = CHANGED;
+    }
+  });
+  std::vector<int> parse;
+  size_t added = 0;
+  for (size_t file = 0; file < files.size(); file++) {
+    if (state[file] != KEPT) parse.push_back((int)file);
+    if (state[file] == ADDED) added++;
+  }
+  if (stats) stats->scan_ms = millisecondsSince(phase);
+
+  // parse what changed, songs vary a lot in size so let idle threads steal
+  clock_gettime(CLOCK_MONOTONIC, &phase);
+  parallelForStealing((int)parse.size(), threads, [&](int item, int) {
+    readSongInfo(files[parse[item]], songs[parse[item]]);
+  });
+  if (stats) stats->parse_ms = millisecondsSince(phase);
+
+  std::vector<char> paths;
+  for (size_t file = 0; file < files.size(); file++) {
+    songs[file].path = (uint32_t)paths.size();
+    paths.insert(paths.end(), files[file].c_str(), files[file].c_str() + files[file].size() + 1);
+  }
+
+  if (stats) {
+    stats->files = files.size();
+    stats->unchanged = files.size() - parse.size();
+    stats->parsed = parse.size();
+    stats->removed = m_songs.size() - (files.size() - added);
+  }
+  m_songs.swap(songs);
+  m_paths.swap(paths);
+  return true;
+}
@@ -0,0 +1,98 @@
+/* song-library.h
+
+Finding songs on disk.  A library is a directory tree of MIDI files; the
+batch compiler and the song index both start from the list of files in it.
+
+The song index keeps what a song picker shows for every file (length,
+tracks, tempo range, note count, busiest second) in one compact file, so
+opening the library is a single read with no MIDI parsing.  Updating it
+stats every file in parallel and parses only the files whose modification
+time or size changed, spread over a work-stealing pool.
+
+Index file: one header, one fixed size SongInfo per song sorted by path,
+then the paths as NUL terminated strings.
+*/
+
+#ifndef _SONG_LIBRARY_H_INCLUDED
+#define _SONG_LIBRARY_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Constants */
+const uint32_t SONG_INDEX_VERSION = 1;
+const uint32_t SONG_UNREADABLE = 1;  // SongInfo::flags, not a MIDI file we can parse
+
+/* Structs */
+struct SongIndexHeader {
+  char     magic[8];    // "THINDEX"
+  uint32_t version;     // SONG_INDEX_VERSION
+  uint32_t headerSize;  // sizeof(SongIndexHeader)
+  uint64_t count;       // songs
+  uint64_t pathBytes;   // size of the path table after the songs
+};
+
+struct SongInfo {
+  int64_t  mtime_ns;            // file modification time and size when parsed
+  uint64_t fileSize;
+  int64_t  duration_us;         // to the last event, like MidiFile::getFileDurationInSeconds()
+  uint32_t path;                // offset into the path table
+  uint32_t flags;
+  uint32_t tracks;
+  int32_t  division;            // ticks per quarter note, negative for SMPTE
+  uint32_t notes;
+  uint32_t peakNotesPerSecond;  // most note ons in any one second
+  uint32_t slowestTempo;        // microseconds per quarter note
+  uint32_t fastestTempo;
+};
+
+// What SongIndex::update() did.
+struct SongIndexStats {
+  size_t files;      // songs in the library now
+  size_t unchanged;  // kept from the old index
+  size_t parsed;     // new or changed, including unreadable ones
+  size_t removed;    // in the old index but gone from disk
+  double scan_ms;    // walking the tree and stating every file
+  double parse_ms;
+};
+
+class SongIndex {
+  public:
+    // False if there is no index file or it is stale, the index is then empty.
+    bool load(const std::string& filename);
+    bool save(const std::string& filename) const;
+
+    // Bring the index in line with the MIDI files under root, parsing on up
+    // to threads threads.  Songs are kept by absolute path, however root is
+    // spelled.  False if root could not be read.
+    bool update(const std::string& root, int threads, SongIndexStats* stats = NULL);
+
+    size_t size(void) const { return m_songs.size(); }
+    const SongInfo& operator[](size_t song) const { return m_songs[song]; }
+    const char* path(size_t song) const { return &m_paths[m_songs[song].path]; }
+
+  private:
+    std::vector<SongInfo> m_songs;
+    std::vector<char>     m_paths;
+};
+
+/* Function References */
+// true for a .mid or .midi file name, in any case
+bool isMidiFileName(const std::string& name);
+
+// Append path if it is a MIDI file, or every MIDI file under it if it is a
+// directory, then sort files so the songs of a directory stay together.
+// False if path could not be read.
+bool findMidiFiles(const std::string& path, std::vector<std::string>& files);
+
+// Index file for the library at root, in the chart cache directory.  Empty
+// if there is nowhere to put it.
+std::string songIndexPath(const std::string& root);
+
+// Read and parse one MIDI file into info, leaving its path, mtime and size
+// alone.  Sets SONG_UNREADABLE and returns false if it cannot be parsed.
+bool readSongInfo(const std::string& filename, SongInfo& info);
+
+#endif /* _SONG_LIBRARY_H_INCLUDED */
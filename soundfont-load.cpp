@@ -0,0 +1,50 @@
+/* soundfont-load.cpp
+
+The sound font loading thread.
+*/
+#include "soundfont-load.h"
+#include "soundfont-presets.h"
+
+#include <time.h>
+
+SoundFontLoad::SoundFontLoad(void)
+  : m_ready(false), m_done(false), m_id(FLUID_FAILED), m_load_ms(0), m_presets(0), m_pinned(0)
+{
+}
+
+SoundFontLoad::~SoundFontLoad()
+{
+  wait();
+}
+
+void SoundFontLoad::start(fluid_synth_t* synth, const char* filename, const std::string* song)
+{
+  if (started()) return;
+  // the load can outlive the caller's bytes, e.g. when main() returns early
+  // and the global loader joins only at exit
+  if (song) m_song = *song;
+  m_thread = std::thread([this, synth, filename, song]() {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    m_id = fluid_synth_sfload(synth, filename, 1);
+    if (m_id != FLUID_FAILED && song) {
+      std::vector<SoundFontPreset> presets;
+      songPresets(m_song, presets);
+      m_presets = (int)presets.size();
+      m_pinned = pinPresets(synth, m_id, presets);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    m_load_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+    // m_id and m_load_ms are published by this store
+    m_ready = true;
+  });
+}
+
+int SoundFontLoad::wait(void)
+{
+  if (m_thread.joinable()) {
+    m_thread.join();
+    m_done = true;
+  }
+  return m_id;
+}
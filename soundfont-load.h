@@ -0,0 +1,57 @@
+/* soundfont-load.h
+
+Background sound font loading.  A big sound font takes seconds to read, so
+it is loaded on its own thread while the MIDI file is parsed, the chart is
+built and the terminal is set up, instead of before all of that.
+
+Nothing may make sound through the synth until wait() has returned; the
+audio driver is created afterwards so it never renders a half loaded font.
+With a song given, the thread then scans it for the presets it uses and
+pins them (see soundfont-presets.h), so their samples are loaded before play.
+*/
+
+#ifndef _SOUNDFONT_LOAD_H_INCLUDED
+#define _SOUNDFONT_LOAD_H_INCLUDED
+
+#include <fluidsynth.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+
+class SoundFontLoad {
+  public:
+    SoundFontLoad(void);
+    ~SoundFontLoad();
+
+    // Start loading filename into synth on a background thread, then pin
+    // the presets song uses unless it is NULL.  song is copied, so the
+    // caller may free it at any time.
+    void start(fluid_synth_t* synth, const char* filename, const std::string* song = NULL);
+    bool started(void) const { return m_thread.joinable() || m_done; }
+    bool ready(void) const { return m_ready; }
+
+    // Block until the load is over, the sound font id or FLUID_FAILED.
+    int wait(void);
+
+    // time the load took, 0 until it is over
+    double load_ms(void) const { return m_ready ? m_load_ms : 0; }
+    // presets the song uses and how many of them were pinned
+    int presets(void) const { return m_ready ? m_presets : 0; }
+    int pinned(void) const { return m_ready ? m_pinned : 0; }
+
+  private:
+    SoundFontLoad(const SoundFontLoad&);
+    SoundFontLoad& operator=(const SoundFontLoad&);
+
+    std::string       m_song;
+    std::thread       m_thread;
+    std::atomic<bool> m_ready;
+    bool              m_done;  // joined
+    int               m_id;
+    double            m_load_ms;
+    int               m_presets;
+    int               m_pinned;
+};
+
+#endif /* _SOUNDFONT_LOAD_H_INCLUDED */
@@ -0,0 +1,153 @@
+/* soundfont-presets.cpp
+
+Preset pinning, and mmap file callbacks for fluidsynth's sound font loader.
+*/
+#include "soundfont-presets.h"
+#include "smf-decoder.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const int DRUM_BANK = 128;
+
+// madvise() for new maps, set by addMappedSoundFontLoader()
+static int mappedAdvice = MADV_NORMAL;
+
+// An open sound font, fluidsynth reads and seeks it through these.
+struct MappedFile {
+  const unsigned char* data;
+  size_t               length;
+  size_t               position;
+};
+
+static void* mappedOpen(const char* filename)
+{
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return NULL;
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+  void* map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+  madvise(map, (size_t)info.st_size, mappedAdvice);
+
+  MappedFile* file = new MappedFile;
+  file->data = (const unsigned char*)map;
+  file->length = (size_t)info.st_size;
+  file->position = 0;
+  return file;
+}
+
+static int mappedRead(void* buffer, fluid_long_long_t count, void* handle)
+{
+  MappedFile* file = (MappedFile*)handle;
+  if (count < 0 || (size_t)count > file->length - file->position) return FLUID_FAILED;
+  memcpy(buffer, file->data + file->position, (size_t)count);
+  file->position += (size_t)count;
+  return FLUID_OK;
+}
+
+static int mappedSeek(void* handle, fluid_long_long_t offset, int origin)
+{
+  MappedFile* file = (MappedFile*)handle;
+  fluid_long_long_t base = origin == SEEK_CUR ? (fluid_long_long_t)file->position
+                         : origin == SEEK_END ? (fluid_long_long_t)file->length : 0;
+  if (base + offset < 0 || base + offset > (fluid_long_long_t)file->length) return FLUID_FAILED;
+  file->position = (size_t)(base + offset);
+  return FLUID_OK;
+}
+
+static fluid_long_long_t mappedTell(void* handle)
+{
+  return (fluid_long_long_t)((MappedFile*)handle)->position;
+}
+
+static int mappedClose(void* handle)
+{
+  MappedFile* file = (MappedFile*)handle;
+  munmap((void*)file->data, file->length);
+  delete file;
+  return FLUID_OK;
+}
+
+void setOnDemandSamples(fluid_settings_t* settings)
+{
+  fluid_settings_setint(settings, "synth.dynamic-sample-loading", 1);
+  fluid_settings_setint(settings, "synth.midi-channels", SONG_CHANNELS + PIN_CHANNELS);
+}
+
+bool addMappedSoundFontLoader(fluid_synth_t* synth, fluid_settings_t* settings)
+{
+  fluid_sfloader_t* loader = new_fluid_defsfloader(settings);
+  if (!loader) return false;
+  // a full load reads the whole file front to back; on demand, the sample
+  // reads are scattered but each one is long, so leave the kernel's default
+  int onDemand = 0;
+  fluid_settings_getint(settings, "synth.dynamic-sample-loading", &onDemand);
+  mappedAdvice = onDemand ? MADV_NORMAL : MADV_SEQUENTIAL;
+  fluid_sfloader_set_callbacks(loader, mappedOpen, mappedRead, mappedSeek, mappedTell, mappedClose);
+  // the synth owns it from here, and tries it before the stdio loader
+  fluid_synth_add_sfloader(synth, loader);
+  return true;
+}
+
+static void addPreset(std::vector<SoundFontPreset>& presets, int bank, int program)
+{
+  for (size_t i = 0; i < presets.size(); i++) {
+    if (presets[i].bank == bank && presets[i].program == program) return;
+  }
+  SoundFontPreset preset = { bank, program };
+  presets.push_back(preset);
+}
+
+void songPresets(const std::string& bytes, std::vector<SoundFontPreset>& presets)
+{
+  presets.clear();
+  SmfLayout layout;
+  if (!readSmfLayout((const unsigned char*)bytes.data(), bytes.size(), layout)) return;
+
+  // bank select and whether a program change has come yet, per channel;
+  // tracks are scanned one after another, which is close enough to know
+  // which presets are used at all
+  int bank[SONG_CHANNELS] = { };
+  bool changed[SONG_CHANNELS] = { };
+  bool played[SONG_CHANNELS] = { };
+  for (size_t track = 0; track < layout.tracks.size(); track++) {
+    SmfTrackDecoder decoder(layout.tracks[track]);
+    SmfEvent event;
+    while (decoder.next(event)) {
+      if (event.status >= 0xF0) continue;
+      int channel = event.status & 0x0F;
+      int drums = channel == DRUM_CHANNEL;
+      switch (event.status & 0xF0) {
+      case 0xB0:
+        if (event.length >= 2 && event.data[0] == 0) bank[channel] = event.data[1];
+        break;
+      case 0xC0:
+        if (event.length >= 1) addPreset(presets, drums ? DRUM_BANK : bank[channel], event.data[0]);
+        changed[channel] = true;
+        break;
+      case 0x90:
+        if (!changed[channel] && !played[channel] && isSmfNoteOn(event)) addPreset(presets, drums ? DRUM_BANK : 0, 0);
+        played[channel] = true;
+        break;
+      }
+    }
+  }
+}
+
+int pinPresets(fluid_synth_t* synth, int soundFont, const std::vector<SoundFontPreset>& presets)
+{
+  int pinned = 0;
+  for (size_t i = 0; i < presets.size() && pinned < PIN_CHANNELS; i++) {
+    if (fluid_synth_program_select(synth, SONG_CHANNELS + pinned, soundFont, presets[i].bank, presets[i].program) == FLUID_OK) pinned++;
+  }
+  return pinned;
+}
@@ -0,0 +1,56 @@
+/* soundfont-presets.h
+
+Sound font residency.  fluidsynth normally copies every sample of a sound
+font into each game's own memory, though a song only plays a few presets.
+
+With synth.dynamic-sample-loading it copies in only the samples of presets
+that are selected on a channel.  The presets a song uses are found by
+scanning its program changes and kept selected on spare channels past the
+song's 16, so their samples stay loaded for the whole game and a program
+change never has to read the disk from the audio thread.  The samples a
+game loads are still its own; nothing is shared between games.
+
+The loader reads the .sf2 through a read-only mmap rather than stdio.  That
+saves the stdio buffer and a read() per chunk, not memory: every read is
+copied out of the map into the game's heap, and the map is closed once the
+samples are in.
+*/
+
+#ifndef _SOUNDFONT_PRESETS_H_INCLUDED
+#define _SOUNDFONT_PRESETS_H_INCLUDED
+
+#include <fluidsynth.h>
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/* Constants */
+const int SONG_CHANNELS = 16;
+const int DRUM_CHANNEL = 9;
+const int PIN_CHANNELS = 48;  // presets a song can keep loaded, synth.midi-channels is a multiple of 16
+
+/* Structs */
+struct SoundFontPreset {
+  int bank;
+  int program;
+};
+
+/* Function References */
+// Settings for a synth that loads samples on demand and has the spare
+// channels, before the synth is created.
+void setOnDemandSamples(fluid_settings_t* settings);
+
+// Give synth a sound font loader that reads files through mmap, read ahead
+// unless settings load samples on demand.  Call before fluid_synth_sfload().
+bool addMappedSoundFontLoader(fluid_synth_t* synth, fluid_settings_t* settings);
+
+// Every preset the song selects: each channel's first preset if it plays
+// notes before a program change, and every program change, drums on bank 128.
+void songPresets(const std::string& bytes, std::vector<SoundFontPreset>& presets);
+
+// Select presets on the spare channels so their samples stay loaded.
+// Returns how many were pinned, at most PIN_CHANNELS.
+int pinPresets(fluid_synth_t* synth, int soundFont, const std::vector<SoundFontPreset>& presets);
+
+#endif /* _SOUNDFONT_PRESETS_H_INCLUDED */
@@ -0,0 +1,56 @@
+/* spsc-queue.h
+
+Bounded single-producer single-consumer ring buffer.  One thread pushes and
+one thread pops, neither ever blocks or allocates: a push into a full queue
+simply fails.  The head and tail indices live on separate cache lines so the
+two threads do not fight over them.
+*/
+
+#ifndef _SPSC_QUEUE_H_INCLUDED
+#define _SPSC_QUEUE_H_INCLUDED
+
+#include <stddef.h>
+#include <atomic>
+
+// Capacity must be a power of two; the queue holds up to Capacity items.
+template <typename T, size_t Capacity>
+class SpscQueue {
+  public:
+    SpscQueue(void) : m_head(0), m_tail(0) { }
+
+    // Producer only.
+    bool push(const T& item)
+    {
+      size_t tail = m_tail.load(std::memory_order_relaxed);
+      if (tail - m_head.load(std::memory_order_acquire) == Capacity) return false;
+      m_items[tail & (Capacity - 1)] = item;
+      // sequentially consistent so a consumer that checks empty() before
+      // going to sleep and a producer that then checks for sleepers agree
+      m_tail.store(tail + 1, std::memory_order_seq_cst);
+      return true;
+    }
+
+    // Consumer only.
+    bool pop(T& item)
+    {
+      size_t head = m_head.load(std::memory_order_relaxed);
+      if (head == m_tail.load(std::memory_order_acquire)) return false;
+      item = m_items[head & (Capacity - 1)];
+      m_head.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    bool empty(void) const
+    {
+      return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_seq_cst);
+    }
+
+  private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+    T m_items[Capacity];
+    alignas(64) std::atomic<size_t> m_head;  // next item to pop
+    alignas(64) std::atomic<size_t> m_tail;  // next free slot
+};
+
+#endif /* _SPSC_QUEUE_H_INCLUDED */
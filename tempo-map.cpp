@@ -0,0 +1,120 @@
+/* tempo-map.cpp
+
+Tempo segment index.
+*/
+#include "tempo-map.h"
+#include "smf-decoder.h"
+
+#include <algorithm>
+
+TempoMap::TempoMap(void)
+{
+  reset(120);
+}
+
+TempoMap::TempoMap(int division)
+{
+  reset(division);
+}
+
+void TempoMap::reset(int division)
+{
+  m_tick.assign(1, 0);
+  m_elapsed.assign(1, 0);
+  m_rate.clear();
+
+  if (division < 0) {
+    // high byte is -frames per second, low byte is ticks per frame; a tick
+    // is a fixed 1/(fps * tpf) seconds and tempo changes are ignored
+    int framesPerSecond = -(int8_t)((division >> 8) & 0xFF);
+    int ticksPerFrame = division & 0xFF;
+    m_ticksPerQuarter = 0;
+    m_denominator = (int64_t)framesPerSecond * (ticksPerFrame ? ticksPerFrame : 1);
+    m_rate.push_back(1000000);
+  } else {
+    m_ticksPerQuarter = division > 0 ? division : 1;
+    m_denominator = m_ticksPerQuarter;
+    m_rate.push_back(SMF_DEFAULT_TEMPO);
+  }
+}
+
+void TempoMap::addTempo(int64_t tick, int microsecondsPerQuarter)
+{
+  if (isSmpte() || microsecondsPerQuarter <= 0) return;
+
+  size_t last = m_tick.size() - 1;
+  if (tick < m_tick[last]) tick = m_tick[last];
+  if (tick == m_tick[last]) {
+    m_rate[last] = microsecondsPerQuarter;
+    return;
+  }
+
+  m_elapsed.push_back(m_elapsed[last] + (tick - m_tick[last]) * m_rate[last]);
+  m_tick.push_back(tick);
+  m_rate.push_back(microsecondsPerQuarter);
+}
+
+size_t TempoMap::segmentAt(int64_t tick) const
+{
+  // last segment starting at or before tick
+  size_t segment = std::upper_bound(m_tick.begin(), m_tick.end(), tick) - m_tick.begin();
+  return segment ? segment - 1 : 0;
+}
+
+int64_t TempoMap::micros(size_t segment, int64_t tick) const
+{
+  int64_t elapsed = m_elapsed[segment] + (tick - m_tick[segment]) * m_rate[segment];
+  if (elapsed < 0) return -((-elapsed + m_denominator / 2) / m_denominator);
+  return (elapsed + m_denominator / 2) / m_denominator;
+}
+
+int64_t TempoMap::toMicros(int64_t tick) const
+{
+  return micros(segmentAt(tick), tick);
+}
+
+int64_t TempoMap::toMicros(int64_t tick, size_t& hint) const
+{
+  size_t segments = m_tick.size();
+  if (hint >= segments || m_tick[hint] > tick) hint = segmentAt(tick);
+  while (hint + 1 < segments && m_tick[hint + 1] <= tick) hint++;
+  return micros(hint, tick);
+}
+
+void TempoMap::toMicros(const int64_t* ticks, int64_t* out, size_t count) const
+{
+  size_t segment = 0;
+  size_t segments = m_tick.size();
+  for (size_t i = 0; i < count; i++) {
+    while (segment + 1 < segments && m_tick[segment + 1] <= ticks[i]) segment++;
+    out[i] = micros(segment, ticks[i]);
+  }
+}
+
+int64_t TempoMap::quarterToMicros(int64_t numerator, int64_t denominator) const
+{
+  if (denominator <= 0) denominator = 1;
+  if (isSmpte()) return (numerator * SMF_DEFAULT_TEMPO + denominator / 2) / denominator;
+
+  // the position in ticks is numerator * tpq / denominator, keep it scaled
+  // by denominator so nothing is rounded until the very end
+  int64_t scaledTick = numerator * m_ticksPerQuarter;
+  size_t segment = segmentAt(scaledTick / denominator);
+  int64_t elapsed = m_elapsed[segment] * denominator + (scaledTick - m_tick[segment] * denominator) * m_rate[segment];
+  int64_t scale = m_denominator * denominator;
+  return (elapsed + scale / 2) / scale;
+}
+
+int64_t TempoMap::toTick(int64_t time) const
+{
+  int64_t elapsed = time * m_denominator;
+  size_t segment = std::upper_bound(m_elapsed.begin(), m_elapsed.end(), elapsed) - m_elapsed.begin();
+  segment = segment ? segment - 1 : 0;
+  return m_tick[segment] + (elapsed - m_elapsed[segment]) / m_rate[segment];
+}
+
+int TempoMap::tempoAt(int64_t tick) const
+{
+  if (isSmpte()) return SMF_DEFAULT_TEMPO;
+  return (int)m_rate[segmentAt(tick)];
+}
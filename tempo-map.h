@@ -0,0 +1,69 @@
+/* tempo-map.h
+
+Tick to time conversion through a segment index.  Every tempo change starts a
+segment; each segment stores its first tick, its rate and the exact time
+elapsed before it, so converting a tick is one segment lookup and one multiply
+with no rounding drift across the song.  Times are kept internally as
+microseconds * denominator, where the denominator is ticks per quarter note
+(or SMPTE ticks per second), which makes every segment boundary exact.
+
+Lookups are binary searches, or amortized O(1) when the caller walks forward
+with a hint; the batch conversion handles a sorted array in one linear pass.
+*/
+
+#ifndef _TEMPO_MAP_H_INCLUDED
+#define _TEMPO_MAP_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TempoMap {
+  public:
+    TempoMap(void);
+    explicit TempoMap(int division);
+
+    // Start over with a Standard MIDI File division field: ticks per quarter
+    // note, or negative SMPTE frames per second and ticks per frame.
+    void reset(int division);
+
+    // Tempo changes must be added in non-decreasing tick order.  A change on
+    // the same tick as the previous one replaces it.
+    void addTempo(int64_t tick, int microsecondsPerQuarter);
+
+    int64_t toMicros(int64_t tick) const;
+    int64_t toMicros(int64_t tick, size_t& hint) const;
+
+    // Convert count non-decreasing ticks in one pass.
+    void toMicros(const int64_t* ticks, int64_t* micros, size_t count) const;
+
+    // Time of a musical position given as numerator / denominator quarter
+    // notes, exact even when the position falls between two ticks.  SMPTE
+    // files have no quarter notes and use the default tempo.
+    int64_t quarterToMicros(int64_t numerator, int64_t denominator) const;
+
+    // Tick at (or just before) a time, the inverse of toMicros().
+    int64_t toTick(int64_t micros) const;
+
+    // Tempo, in microseconds per quarter note, in effect at tick.
+    int tempoAt(int64_t tick) const;
+
+    size_t segmentCount(void) const { return m_tick.size(); }
+    int64_t segmentTick(size_t segment) const { return m_tick[segment]; }
+    int ticksPerQuarter(void) const { return m_ticksPerQuarter; }
+    bool isSmpte(void) const { return m_ticksPerQuarter == 0; }
+
+  private:
+    size_t segmentAt(int64_t tick) const;
+    int64_t micros(size_t segment, int64_t tick) const;
+
+    // segment columns
+    std::vector<int64_t> m_tick;     // first tick of the segment
+    std::vector<int64_t> m_elapsed;  // time before the segment, in microseconds * m_denominator
+    std::vector<int64_t> m_rate;     // microseconds * m_denominator per tick
+
+    int64_t m_denominator;
+    int     m_ticksPerQuarter;       // 0 for SMPTE
+};
+
+#endif /* _TEMPO_MAP_H_INCLUDED */
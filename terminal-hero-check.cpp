@@ -0,0 +1,683 @@
+/* terminal-hero-check.cpp
+
+Self checks for the loaders and schedulers.  Every check builds a small
+Standard MIDI File in memory, runs it through the game's code and compares
+the result against an independent computation.  Prints one line per check
+and exits non-zero if any of them failed.
+
+Usage: terminal-hero-check
+*/
+#include "backing-track.h"
+#include "chart-cache.h"
+#include "chart-stream.h"
+#include "judge.h"
+#include "lane-map.h"
+#include "midi-join.h"
+#include "scroll-scheduler.h"
+#include "timer-wheel.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*-------------------\
+|--- Synthetic SMF --|
+\-------------------*/
+// Variable length quantity, as used for delta times in a MIDI file.
+static void putVariableLength(string& out, uint32_t value)
+{
+  unsigned char bytes[5];
+  int count = 0;
+  do {
+    bytes[count++] = value & 0x7F;
+    value >>= 7;
+  } while (value);
+  while (count > 1) out += (char)(bytes[--count] | 0x80);
+  out += (char)bytes[0];
+}
+
+static void putBigEndian(string& out, uint32_t value, int bytes)
+{
+  while (bytes--) out += (char)((value >> (8 * bytes)) & 0xFF);
+}
+
+static void putTrack(string& smf, const string& events)
+{
+  smf += "MTrk";
+  putBigEndian(smf, (uint32_t)events.size() + 4, 4);
+  smf += events;
+  smf += string("\x00\xFF\x2F\x00", 4);  // end of track
+}
+
+// A channel message delta ticks after the previous event.
+static void putMessage(string& track, uint32_t delta, int status, int data1, int data2)
+{
+  putVariableLength(track, delta);
+  track += (char)status;
+  track += (char)data1;
+  track += (char)data2;
+}
+
+// Header of a type 1 file with tracks tracks, put the tracks after it.
+static string smfHeader(int tracks, int division)
+{
+  string smf = "MThd";
+  putBigEndian(smf, 6, 4);
+  putBigEndian(smf, 1, 2);
+  putBigEndian(smf, tracks, 2);
+  putBigEndian(smf, division, 2);
+  return smf;
+}
+
+// Stream smf into chart the way a --stream game does, all of it.
+static bool streamChart(const string& smf, NoteChart& chart)
+{
+  ChartStream stream;
+  if (!stream.start(smf, 0, 1)) return false;
+  chart.setDivision(stream.division());
+  stream.waitUntilReady();
+  while (stream.drainInto(chart)) usleep(1000);
+  return !stream.failed();
+}
+
+/*-------------------\
+|------ Tempo -------|
+\-------------------*/
+// Song time of tick worked out in floating point straight from the tempo
+// list, independent of TempoMap.
+static double expectedMicros(double tick, const int tempoTicks[], const int tempos[], int tempoCount, int division)
+{
+  double elapsed = 0;
+  for (int i = 0; i < tempoCount; i++) {
+    double end = i + 1 < tempoCount ? tempoTicks[i + 1] : tick;
+    if (end > tick) end = tick;
+    if (end > tempoTicks[i]) elapsed += (end - tempoTicks[i]) * tempos[i] / division;
+  }
+  return elapsed;
+}
+
+// Play chart on a virtual clock and check every row and every spawned note.
+// Note i of the song is at tick i * noteSpacing.
+static bool checkScroll(const char* name, const NoteChart& songChart, size_t expectedNotes, int noteSpacing,
+                        const int tempoTicks[], const int tempos[], int tempoCount, int division)
+{
+  bool ok = songChart.size() == expectedNotes;
+  double maxNoteError = 0, maxRowError = 0;
+  for (size_t i = 0; i < songChart.size(); i++) {
+    double error = fabs(songChart.time_us[i] - expectedMicros((double)i * noteSpacing, tempoTicks, tempos, tempoCount, division));
+    if (error > maxNoteError) maxNoteError = error;
+  }
+
+  ScrollScheduler rows(songChart.tempoMap());
+  size_t cursor = 0;
+  int64_t previousRow = INT64_MIN;
+  int misplaced = 0;
+  while (cursor < songChart.size() && rows.row() < 1000000) {
+    int64_t row_us = rows.advance();
+    double expected = expectedMicros(rows.row() * (double)division / ROWS_PER_QUARTER, tempoTicks, tempos, tempoCount, division);
+    if (fabs(row_us - expected) > maxRowError) maxRowError = fabs(row_us - expected);
+
+    // every note spawned now must be due by this row and not by the last
+    size_t due = dueNotes(songChart, cursor, row_us + SPAWN_SLACK_US);
+    for (; cursor < due; cursor++) {
+      int64_t time = songChart.time_us[cursor];
+      if (time > row_us + SPAWN_SLACK_US || (previousRow != INT64_MIN && time <= previousRow + SPAWN_SLACK_US)) misplaced++;
+    }
+    previousRow = row_us;
+  }
+  ok = ok && cursor == songChart.size() && misplaced == 0 && maxNoteError < 1000 && maxRowError < 1000;
+
+  cout << fixed << setprecision(3) << "Tempo, " << name << ": " << songChart.size() << " notes over " << rows.row()
+       << " rows, max note error " << maxNoteError << " us, max row drift " << maxRowError
+       << " us, " << misplaced << " spawned on the wrong row" << (ok ? "" : "  FAILED") << endl;
+  return ok;
+}
+
+// Build a song whose tempo changes several times, some of them between two
+// rows, and check the scroll follows it through every loader.
+static bool checkTempo(void)
+{
+  const int DIVISION = 90;  // 22.5 ticks per row, rows fall between ticks
+  const int TEMPO_COUNT = 6;
+  const int tempoTicks[TEMPO_COUNT] = { 0, 360, 1000, 1417, 2700, 3000 };
+  const int tempos[TEMPO_COUNT] = { 500000, 400000, 666667, 300000, 800000, 461538 };
+  const int NOTE_SPACING = 37;
+  const int NOTES = 120;
+
+  // track 0 holds the tempo map, track 1 the notes, as most songs do
+  string tempoTrack, noteTrack;
+  int lastTick = 0;
+  for (int i = 0; i < TEMPO_COUNT; i++) {
+    putVariableLength(tempoTrack, tempoTicks[i] - lastTick);
+    tempoTrack += string("\xFF\x51\x03", 3);
+    putBigEndian(tempoTrack, tempos[i], 3);
+    lastTick = tempoTicks[i];
+  }
+  putVariableLength(tempoTrack, 0);
+  lastTick = 0;
+  for (int i = 0; i < NOTES; i++) {
+    int key = 48 + (i * 7) % 24;
+    putVariableLength(noteTrack, i * NOTE_SPACING - lastTick);
+    noteTrack += (char)0x90;
+    noteTrack += (char)key;
+    noteTrack += (char)100;
+    putVariableLength(noteTrack, NOTE_SPACING / 2);
+    noteTrack += (char)0x80;
+    noteTrack += (char)key;
+    noteTrack += (char)0;
+    lastTick = i * NOTE_SPACING + NOTE_SPACING / 2;
+  }
+  putVariableLength(noteTrack, 0);
+
+  string smf = smfHeader(2, DIVISION);
+  putTrack(smf, tempoTrack);
+  putTrack(smf, noteTrack);
+  uint64_t hash = hashBytes(smf.data(), smf.size());
+
+  bool ok = true;
+  EventStore compiledEvents;
+  NoteChart compiled;
+  ok = compileChartFromEvents(smf, hash, compiledEvents, compiled) &&
+       checkScroll("event store", compiled, NOTES, NOTE_SPACING, tempoTicks, tempos, TEMPO_COUNT, DIVISION) && ok;
+
+  NoteChart streamed;
+  ok = streamChart(smf, streamed) &&
+       checkScroll("stream", streamed, NOTES, NOTE_SPACING, tempoTicks, tempos, TEMPO_COUNT, DIVISION) && ok;
+  return ok;
+}
+
+/*-------------------\
+|----- Pairing ------|
+\-------------------*/
+// Compare the durations in chart against expected, in chart order.
+static bool checkDurations(const char* song, const char* loader, bool loaded, const NoteChart& songChart,
+                           const int64_t expected[], size_t count)
+{
+  if (!loaded) {
+    cout << "Pairing, " << song << ", " << loader << ": could not load the song  FAILED" << endl;
+    return false;
+  }
+  size_t wrong = songChart.size() == count ? 0 : count;
+  for (size_t i = 0; i < count && i < songChart.size(); i++) {
+    if (songChart.duration_us[i] != expected[i]) wrong++;
+  }
+  cout << "Pairing, " << song << ", " << loader << ": " << songChart.size() << " notes, " << wrong
+       << " with the wrong length" << (wrong ? "  FAILED" : "") << endl;
+  return wrong == 0;
+}
+
+// Run smf through every loader that writes the chart cache and check each
+// note's length.
+static bool checkPairing(const char* song, const string& smf, const int64_t expected[], size_t count)
+{
+  uint64_t hash = hashBytes(smf.data(), smf.size());
+  EventStore compiledEvents;
+  MergeJoinMidiFile midifile;
+  NoteChart compiled, viaMidiFile, streamed;
+  bool loaded = compileChartFromEvents(smf, hash, compiledEvents, compiled);
+  bool ok = checkDurations(song, "event store", loaded, compiled, expected, count);
+  loaded = compileChartFromBytes(smf, hash, midifile, viaMidiFile);
+  ok = checkDurations(song, "MidiFile", loaded, viaMidiFile, expected, count) && ok;
+  loaded = streamChart(smf, streamed);
+  ok = checkDurations(song, "stream", loaded, streamed, expected, count) && ok;
+  return ok;
+}
+
+// Notes on the same channel and key that overlap pair up within their own
+// track, newest first, whichever loader built the chart.
+static bool checkOverlaps(void)
+{
+  const int DIVISION = 96;  // 120 bpm, a tick is 5208.33 us
+
+  // two tracks both hold key 60 on channel 0, the second inside the first
+  string tempoTrack, outer, inner;
+  putVariableLength(tempoTrack, 0);
+  tempoTrack += string("\xFF\x51\x03", 3);
+  putBigEndian(tempoTrack, 500000, 3);
+  putMessage(outer, 0, 0x90, 60, 100);
+  putMessage(outer, 192, 0x80, 60, 0);
+  putMessage(inner, 96, 0x90, 60, 100);
+  putMessage(inner, 48, 0x80, 60, 0);
+  string smf = smfHeader(3, DIVISION);
+  putTrack(smf, tempoTrack);
+  putTrack(smf, outer);
+  putTrack(smf, inner);
+  const int64_t acrossTracks[2] = { 1000000, 250000 };
+  bool ok = checkPairing("across tracks", smf, acrossTracks, 2);
+
+  // the same two notes in one track, the first note off ends the newest
+  // note, as in MidiFile::linkNotePairs()
+  string track;
+  putMessage(track, 0, 0x90, 60, 100);
+  putMessage(track, 96, 0x90, 60, 100);
+  putMessage(track, 48, 0x80, 60, 0);
+  putMessage(track, 48, 0x80, 60, 0);
+  smf = smfHeader(2, DIVISION);
+  putTrack(smf, tempoTrack);
+  putTrack(smf, track);
+  const int64_t inOneTrack[2] = { 1000000, 250000 };
+  ok = checkPairing("one track", smf, inOneTrack, 2) && ok;
+  return ok;
+}
+
+/*-------------------\
+|------- Join -------|
+\-------------------*/
+// Eight tracks whose events tie on every tick: identical note ons and note
+// offs, and controllers and pitch bends that eventcompare() cannot order
+// either, each in a different track.  The merge join must put them in the
+// same order as the library's sort, which breaks those ties on seq.
+static bool checkJoin(void)
+{
+  const int TRACKS = 8;
+  const int EVENTS = 64;
+  const int DIVISION = 96;
+
+  string smf = smfHeader(TRACKS + 1, DIVISION);
+  string tempoTrack;
+  putVariableLength(tempoTrack, 0);
+  tempoTrack += string("\xFF\x51\x03", 3);
+  putBigEndian(tempoTrack, 500000, 3);
+  putTrack(smf, tempoTrack);
+  for (int track = 0; track < TRACKS; track++) {
+    string events;
+    for (int i = 0; i < EVENTS; i++) {
+      uint32_t delta = i % 4 ? 0 : 48;
+      int channel = track % 2;
+      switch ((i + track) % 4) {
+        case 0: putMessage(events, delta, 0x90 | channel, 60 + i % 3, 100); break;
+        case 1: putMessage(events, delta, 0x80 | channel, 60 + i % 3, 0); break;
+        case 2: putMessage(events, delta, 0xB0 | channel, 7, 90 + track); break;
+        default: putMessage(events, delta, 0xE0 | channel, 0, 64); break;
+      }
+    }
+    putTrack(smf, events);
+  }
+
+  smf::MidiFile sorted;
+  MergeJoinMidiFile merged;
+  istringstream sortedStream(smf), mergedStream(smf);
+  if (!sorted.read(sortedStream) || !merged.read(mergedStream)) {
+    cout << "Join: could not load the song  FAILED" << endl;
+    return false;
+  }
+  // number the events in file order, the key the library sorts ties by
+  sorted.markSequence();
+  merged.markSequence();
+  sorted.joinTracks();
+  merged.joinTracks();
+
+  int difference = firstJoinDifference(sorted, merged);
+  bool ok = difference < 0 && merged[0].size() == sorted[0].size();
+  cout << "Join: " << merged[0].size() << " events, ";
+  if (difference < 0) cout << "identical to MidiFile::joinTracks()";
+  else cout << "first difference at joined event " << difference;
+  cout << (ok ? "" : "  FAILED") << endl;
+  return ok;
+}
+
+/*-------------------\
+|----- Backing ------|
+\-------------------*/
+// Backing events are delayed by the rows a note takes to fall down the
+// board.  A tempo change that comes before the delayed position, but after
+// the event itself, must still set the pace of the delay.
+static bool checkBackingDelay(void)
+{
+  const int DIVISION = 90;
+  const int DELAY_ROWS = 15;  // 337.5 ticks, as on a 16 row board
+  const int TEMPO_COUNT = 3;
+  const int tempoTicks[TEMPO_COUNT] = { 0, 180, 500 };
+  const int tempos[TEMPO_COUNT] = { 500000, 250000, 600000 };
+  // a patch change and two notes, on a channel the player does not play
+  const int EVENTS = 5;
+  const int eventTicks[EVENTS] = { 0, 0, 90, 250, 400 };
+  const int status[EVENTS] = { 0xC1, 0x91, 0x81, 0x91, 0x81 };
+  const int data1[EVENTS] = { 5, 64, 64, 67, 67 };
+  const int data2[EVENTS] = { -1, 100, 0, 100, 0 };  // -1, a one byte message
+
+  string tempoTrack, backingTrack;
+  int lastTick = 0;
+  for (int i = 0; i < TEMPO_COUNT; i++) {
+    putVariableLength(tempoTrack, tempoTicks[i] - lastTick);
+    tempoTrack += string("\xFF\x51\x03", 3);
+    putBigEndian(tempoTrack, tempos[i], 3);
+    lastTick = tempoTicks[i];
+  }
+  lastTick = 0;
+  for (int i = 0; i < EVENTS; i++) {
+    putVariableLength(backingTrack, eventTicks[i] - lastTick);
+    backingTrack += (char)status[i];
+    backingTrack += (char)data1[i];
+    if (data2[i] >= 0) backingTrack += (char)data2[i];
+    lastTick = eventTicks[i];
+  }
+  string smf = smfHeader(2, DIVISION);
+  putTrack(smf, tempoTrack);
+  putTrack(smf, backingTrack);
+
+  BackingTrack backing;
+  bool ok = backing.load(smf, 1 << 0, DELAY_ROWS, ROWS_PER_QUARTER) && backing.size() == EVENTS;
+  double maxError = 0;
+  for (size_t i = 0; ok && i < backing.size(); i++) {
+    double delayed = eventTicks[i] + (double)DELAY_ROWS * DIVISION / ROWS_PER_QUARTER;
+    double error = fabs(backing.events()[i].time_us - expectedMicros(delayed, tempoTicks, tempos, TEMPO_COUNT, DIVISION));
+    if (error > maxError) maxError = error;
+  }
+  ok = ok && maxError < 1;
+  cout << fixed << setprecision(3) << "Backing delay: " << backing.size() << " events, max error " << maxError
+       << " us" << (ok ? "" : "  FAILED") << endl;
+  return ok;
+}
+
+/*-------------------\
+|------ Judge -------|
+\-------------------*/
+// Notes off the 16th note grid, triplets, swing and played timing, are
+// judged on their own time plus the board delay, the time the backing
+// track would play them.  A press on that time is a 0 us hit.
+static bool checkHitTimes(void)
+{
+  const int DIVISION = 96;
+  const int DELAY_ROWS = 15;
+  const int TEMPO_COUNT = 3;
+  const int tempoTicks[TEMPO_COUNT] = { 0, 200, 430 };  // both inside some note's delay
+  const int tempos[TEMPO_COUNT] = { 500000, 350000, 620000 };
+  const int NOTES = 8;
+  const int noteTicks[NOTES] = { 0, 32, 64, 96, 168, 203, 259, 317 };
+
+  string tempoTrack, noteTrack;
+  int lastTick = 0;
+  for (int i = 0; i < TEMPO_COUNT; i++) {
+    putVariableLength(tempoTrack, tempoTicks[i] - lastTick);
+    tempoTrack += string("\xFF\x51\x03", 3);
+    putBigEndian(tempoTrack, tempos[i], 3);
+    lastTick = tempoTicks[i];
+  }
+  lastTick = 0;
+  for (int i = 0; i < NOTES; i++) {
+    putMessage(noteTrack, noteTicks[i] - lastTick, 0x90, 60 + i, 100);
+    putMessage(noteTrack, 8, 0x80, 60 + i, 0);
+    lastTick = noteTicks[i] + 8;
+  }
+  string smf = smfHeader(2, DIVISION);
+  putTrack(smf, tempoTrack);
+  putTrack(smf, noteTrack);
+
+  EventStore events;
+  NoteChart songChart;
+  bool ok = compileChartFromEvents(smf, hashBytes(smf.data(), smf.size()), events, songChart) && songChart.size() == NOTES;
+  Judge judge(1);
+  for (size_t i = 0; ok && i < songChart.size(); i++) {
+    judge.add(0, noteHitTime(songChart.tempoMap(), songChart.time_us[i], DELAY_ROWS), songChart.key[i], i);
+  }
+  int64_t maxError = 0;
+  int perfect = 0;
+  for (int i = 0; ok && i < NOTES; i++) {
+    double delayed = noteTicks[i] + (double)DELAY_ROWS * DIVISION / ROWS_PER_QUARTER;
+    JudgeResult result = judge.press(0, llround(expectedMicros(delayed, tempoTicks, tempos, TEMPO_COUNT, DIVISION)));
+    int64_t error = result.offset_us < 0 ? -result.offset_us : result.offset_us;
+    if (error > maxError) maxError = error;
+    if (result.grade == JUDGE_PERFECT && result.key == 60 + i) perfect++;
+  }
+  ok = ok && perfect == NOTES && maxError <= 1;
+  cout << "Hit times: " << perfect << " of " << NOTES << " off-grid notes perfect, max hit error " << maxError
+       << " us" << (ok ? "" : "  FAILED") << endl;
+  return ok;
+}
+
+// Grading, nearest note selection, chords replacing a note and expiry, on
+// the default windows: 25, 50 and 100 ms, breaking up to 150 ms early.
+static bool checkJudge(void)
+{
+  struct Press {
+    unsigned int lane;
+    int64_t      press_us;
+    Judgment     grade;
+    int          key;
+    int64_t      offset_us;
+  };
+  const int PRESSES = 7;
+  const Press presses[PRESSES] = {
+    { 0, 1010000, JUDGE_PERFECT, 60, 10000 },
+    { 0, 1130000, JUDGE_PERFECT, 64, -20000 },  // nearer the later note
+    { 0, 1160000, JUDGE_GOOD, 62, 60000 },      // the one it skipped
+    { 0, 1800000, JUDGE_NONE, 0, 0 },           // too early to count
+    { 0, 1870000, JUDGE_MISS, 65, -130000 },    // early enough to break it
+    { 1, 1040000, JUDGE_GREAT, 67, 40000 },     // the second note of the chord
+    { 2, 1000000, JUDGE_NONE, 0, 0 },           // empty lane
+  };
+
+  Judge judge(4);
+  judge.add(0, 1000000, 60, 0);
+  judge.add(0, 1100000, 62, 1);
+  judge.add(0, 1150000, 64, 2);
+  judge.add(0, 2000000, 65, 3);
+  judge.add(1, 1000000, 66, 4);
+  judge.add(1, 1000000, 67, 5);
+  judge.add(3, 3000000, 69, 6);
+
+  int wrong = 0;
+  for (int i = 0; i < PRESSES; i++) {
+    JudgeResult result = judge.press(presses[i].lane, presses[i].press_us);
+    if (result.grade != presses[i].grade) wrong++;
+    else if (result.grade != JUDGE_NONE && (result.key != presses[i].key || result.offset_us != presses[i].offset_us)) wrong++;
+  }
+  if (judge.press(7, 1000000).grade != JUDGE_NONE) wrong++;
+  // a note is missed once its good window has closed, not before
+  if (judge.nextHit(3) != 3000000 || judge.expire(3100000) != 0) wrong++;
+  if (judge.expire(3100001) != 1 || judge.nextHit(3) != -1 || judge.nextHit(0) != -1) wrong++;
+  if (judge.count(JUDGE_PERFECT) != 2 || judge.count(JUDGE_GREAT) != 1 || judge.count(JUDGE_GOOD) != 1 ||
+      judge.count(JUDGE_MISS) != 2) wrong++;
+
+  cout << "Judge: " << PRESSES + 4 << " cases, " << wrong << " wrong" << (wrong ? "  FAILED" : "") << endl;
+  return wrong == 0;
+}
+
+/*-------------------\
+|----- Lane map -----|
+\-------------------*/
+// A four note chord, a step up, a repeat, a leap down and a leap up, with a
+// drum note in between, mapped in every tier.  The lanes were worked out by
+// hand from the rules in lane-map.h.
+static bool checkLaneMap(void)
+{
+  const int DIVISION = 96;  // a 16th note is 24 ticks
+  struct Expected {
+    int     tick;
+    int     channel;
+    int     key;
+    uint8_t lanes[DIFFICULTY_COUNT];  // easy, medium, hard
+  };
+  const uint8_t X = LANE_NONE;
+  const int NOTES = 9;
+  const Expected expected[NOTES] = {
+    { 0,   0, 48, { X, 2, 0 } },  // medium keeps the top and the bass
+    { 0,   0, 60, { X, X, 1 } },
+    { 0,   0, 64, { X, X, 2 } },
+    { 0,   0, 67, { 3, 3, 3 } },  // 67 % 4, the first group's lane
+    { 24,  0, 69, { X, X, 2 } },  // a step up against the edge steps back in
+    { 48,  0, 69, { X, 2, 2 } },  // a repeat stays put, medium is 2 rows on
+    { 72,  0, 60, { X, X, 0 } },  // a leap moves two lanes
+    { 96,  9, 36, { X, X, X } },  // the drums are not the player's
+    { 192, 0, 72, { 2, 3, 2 } },
+  };
+
+  string tempoTrack, noteTrack;
+  putVariableLength(tempoTrack, 0);
+  tempoTrack += string("\xFF\x51\x03", 3);
+  putBigEndian(tempoTrack, 500000, 3);
+  int lastTick = 0;
+  for (int i = 0; i < NOTES; i++) {
+    putMessage(noteTrack, expected[i].tick - lastTick, 0x90 | expected[i].channel, expected[i].key, 100);
+    lastTick = expected[i].tick;
+  }
+  for (int i = 0; i < NOTES; i++) putMessage(noteTrack, i ? 0 : 12, 0x80 | expected[i].channel, expected[i].key, 0);
+  string smf = smfHeader(2, DIVISION);
+  putTrack(smf, tempoTrack);
+  putTrack(smf, noteTrack);
+
+  EventStore events;
+  NoteChart songChart;
+  bool ok = compileChartFromEvents(smf, hashBytes(smf.data(), smf.size()), events, songChart) && songChart.size() == NOTES;
+  LaneMap lanes;
+  lanes.reset(1 << 0);
+  // while the song streams in, the last group waits for a later note
+  if (ok) lanes.extend(songChart, false);
+  ok = ok && lanes.mapped() == NOTES - 1;
+  if (ok) lanes.extend(songChart, true);
+  ok = ok && lanes.mapped() == NOTES;
+
+  int wrong = 0;
+  for (size_t i = 0; ok && i < songChart.size(); i++) {
+    const Expected* note = NULL;
+    for (int e = 0; e < NOTES; e++) {
+      if (expected[e].key == songChart.key[i] && expected[e].channel == songChart.channel[i] &&
+          llround(expected[e].tick * 500000.0 / DIVISION) == songChart.time_us[i]) note = &expected[e];
+    }
+    if (!note) {
+      wrong++;
+      continue;
+    }
+    for (int tier = 0; tier < DIFFICULTY_COUNT; tier++) {
+      if (lanes.lane(tier, i) != note->lanes[tier]) wrong++;
+    }
+  }
+  ok = ok && wrong == 0 && lanes.notes(DIFFICULTY_EASY) == 2 && lanes.notes(DIFFICULTY_MEDIUM) == 4 &&
+       lanes.notes(DIFFICULTY_HARD) == 8;
+  cout << "Lane map: " << songChart.size() << " notes, " << lanes.notes(DIFFICULTY_EASY) << '/'
+       << lanes.notes(DIFFICULTY_MEDIUM) << '/' << lanes.notes(DIFFICULTY_HARD) << " charted easy/medium/hard, "
+       << wrong << " in the wrong lane" << (ok ? "" : "  FAILED") << endl;
+  return ok;
+}
+
+/*-------------------\
+|---- Timer wheel ---|
+\-------------------*/
+// Deterministic pseudo random numbers, the same run every time.
+static uint32_t nextRandom(uint64_t& state)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return (uint32_t)(state >> 16);
+}
+
+struct ModelTimer {
+  int64_t  tick;     // when it fires, clamped the way the wheel clamps
+  uint32_t payload;  // also the order it was scheduled in
+  uint64_t id;
+  bool     live;
+};
+
+static bool modelFiresBefore(const ModelTimer& a, const ModelTimer& b)
+{
+  return a.tick != b.tick ? a.tick < b.tick : a.payload < b.payload;
+}
+
+// Run random schedules, cancels and advances through the wheel and through
+// a sorted list, and compare what fires, in what order, and what is pending.
+// Deadlines range from overdue to past the top level, so every cascade and
+// the clamp at the end of the range are exercised.
+static bool checkTimerWheel(void)
+{
+  const int64_t TICK_US = 1000;
+  const int64_t RANGE = (int64_t)1 << 24;  // ticks the wheel reaches
+  const int OPERATIONS = 40000;
+  TimerWheel wheel(TICK_US);
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  int64_t now = 987654;  // next tick the wheel will process
+  wheel.reset(now * TICK_US);
+
+  std::vector<ModelTimer> timers, due;
+  std::vector<uint32_t> expired;
+  std::vector<size_t> live;
+  uint32_t payload = 0;
+  size_t fired = 0, cancelled = 0, mismatches = 0, lateDeadlines = 0;
+  int64_t spans[4] = { 64, 4096, 262144, 4 * RANGE };
+  for (int op = 0; op < OPERATIONS && mismatches == 0; op++) {
+    uint32_t kind = nextRandom(state) % 10;
+    if (kind < 5) {
+      int64_t when_us = (now - 3) * TICK_US + (int64_t)(nextRandom(state) % (uint32_t)(spans[nextRandom(state) % 4] * TICK_US / 64)) * 64;
+      ModelTimer timer;
+      timer.tick = (when_us + TICK_US - 1) / TICK_US;
+      if (timer.tick > now + RANGE - 1) timer.tick = now + RANGE - 1;
+      if (timer.tick < now) timer.tick = now;
+      timer.payload = payload++;
+      timer.id = wheel.schedule(when_us, timer.payload);
+      timer.live = true;
+      live.push_back(timers.size());
+      timers.push_back(timer);
+    } else if (kind < 7 && !timers.empty()) {
+      // any timer, fired, cancelled or live
+      ModelTimer& timer = timers[nextRandom(state) % timers.size()];
+      if (wheel.cancel(timer.id) != timer.live) mismatches++;
+      if (timer.live) cancelled++;
+      timer.live = false;
+    } else {
+      uint32_t size = nextRandom(state) % 100;
+      int64_t step = size < 60 ? nextRandom(state) % 4 : size < 95 ? nextRandom(state) % 300
+                   : size < 99 ? nextRandom(state) % 100000 : nextRandom(state) % (RANGE / 4);
+      int64_t target = now + step - 1;
+      expired.clear();
+      wheel.advance(target * TICK_US, expired);
+      due.clear();
+      size_t kept = 0;
+      for (size_t i = 0; i < live.size(); i++) {
+        ModelTimer& timer = timers[live[i]];
+        if (!timer.live) continue;
+        if (timer.tick <= target) {
+          due.push_back(timer);
+          timer.live = false;
+        } else {
+          live[kept++] = live[i];
+        }
+      }
+      live.resize(kept);
+      std::sort(due.begin(), due.end(), modelFiresBefore);
+      if (expired.size() != due.size()) mismatches++;
+      for (size_t i = 0; i < due.size() && i < expired.size(); i++) {
+        if (expired[i] != due[i].payload) mismatches++;
+      }
+      fired += due.size();
+      if (target >= now) now = target + 1;
+    }
+
+    int64_t earliest = -1;
+    for (size_t i = 0; i < live.size(); i++) {
+      const ModelTimer& timer = timers[live[i]];
+      if (timer.live && (earliest < 0 || timer.tick < earliest)) earliest = timer.tick;
+    }
+    if (wheel.pending() != (size_t)std::count_if(live.begin(), live.end(), [&](size_t i) { return timers[i].live; })) mismatches++;
+    if (earliest >= 0 && (wheel.nextDeadline() < 0 || wheel.nextDeadline() > earliest * TICK_US)) lateDeadlines++;
+  }
+  bool ok = mismatches == 0 && lateDeadlines == 0;
+  cout << "Timer wheel: " << timers.size() << " scheduled, " << fired << " fired, " << cancelled << " cancelled, "
+       << mismatches << " mismatches against the model, " << lateDeadlines << " late deadlines"
+       << (ok ? "" : "  FAILED") << endl;
+  return ok;
+}
+
+int main(void)
+{
+  bool ok = true;
+  ok = checkTempo() && ok;
+  ok = checkOverlaps() && ok;
+  ok = checkJoin() && ok;
+  ok = checkBackingDelay() && ok;
+  ok = checkHitTimes() && ok;
+  ok = checkJudge() && ok;
+  ok = checkLaneMap() && ok;
+  ok = checkTimerWheel() && ok;
+
+  cout << (ok ? "OK" : "FAILED") << endl;
+  return ok ? 0 : 1;
+}
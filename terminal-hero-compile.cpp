@@ -0,0 +1,126 @@
+/* terminal-hero-compile.cpp
+
+Batch chart compiler.  Walks MIDI files and directory trees of them and
+writes every song's note chart into the chart cache, where the game maps it
+on a warm start.  Songs go through the compact event store, the game's own
+default loader, or through the smf::MidiFile pipeline of
+`terminal-hero --midifile` (read, linkNotePairs, doTimeAnalysis,
+joinTracks) with --midifile.
+
+Files are spread over a work-stealing pool, one song per task, each worker
+keeping its own MidiFile and chart.  A song whose bytes hash to a chart
+that is already cached is skipped.
+
+Usage: terminal-hero-compile [--threads=N] [--midifile] [--force] PATH...
+*/
+#include "Options.h"
+#include "chart-cache.h"
+#include "midi-join.h"
+#include "parallel.h"
+#include "song-library.h"
+
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+using namespace smf;
+
+/* Structs */
+// Everything one pool thread needs, so workers share nothing while compiling.
+struct CompileWorker {
+  MergeJoinMidiFile midifile;
+  EventStore        events;
+  NoteChart         chart;
+  string            bytes;
+  size_t            compiled;
+  size_t            skipped;
+  size_t            failed;
+  uint64_t          bytesRead;
+
+  CompileWorker(void) : compiled(0), skipped(0), failed(0), bytesRead(0) { }
+};
+
+// Compile one song, unless its chart is already cached.
+static void compileSong(const string& filename, CompileWorker& worker, bool useMidiFile, bool force)
+{
+  if (!readFileBytes(filename, worker.bytes)) {
+    cerr << "Could not read " << filename << endl;
+    worker.failed++;
+    return;
+  }
+  worker.bytesRead += worker.bytes.size();
+
+  uint64_t hash = hashBytes(worker.bytes.data(), worker.bytes.size());
+  if (!force && mapCachedChart(hash, worker.chart)) {
+    worker.skipped++;
+    worker.chart.clear();
+    return;
+  }
+
+  bool ok = useMidiFile ? compileChartFromBytes(worker.bytes, hash, worker.midifile, worker.chart)
+                        : compileChartFromEvents(worker.bytes, hash, worker.events, worker.chart);
+  if (ok && cacheChart(worker.chart)) {
+    worker.compiled++;
+  } else {
+    cerr << "Could not compile " << filename << endl;
+    worker.failed++;
+  }
+  worker.chart.clear();
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  options.define("threads=i:0", "songs compiled at once, 0 for one per core");
+  options.define("midifile=b", "compile through smf::MidiFile instead of the compact event store");
+  options.define("force=b", "compile every song, even if its chart is cached");
+  options.process(argc, argv);
+
+  if (options.getArgCount() < 1) {
+    cerr << "Usage: " << argv[0] << " [--threads=N] [--midifile] [--force] PATH..." << endl;
+    return 1;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  vector<string> files;
+  size_t unreadable = 0;
+  for (int arg = 1; arg <= options.getArgCount(); arg++) {
+    if (findMidiFiles(options.getArg(arg), files)) continue;
+    cerr << "Could not read " << options.getArg(arg) << endl;
+    unreadable++;
+  }
+
+  int threads = options.getInteger("threads") > 0 ? options.getInteger("threads") : hardwareThreads();
+  if (threads > (int)files.size()) threads = files.empty() ? 1 : (int)files.size();
+  bool useMidiFile = options.getBoolean("midifile");
+  bool force = options.getBoolean("force");
+
+  vector<CompileWorker> workers(threads);
+  int steals = parallelForStealing((int)files.size(), threads, [&](int file, int worker) {
+    compileSong(files[file], workers[worker], useMidiFile, force);
+  });
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  size_t compiled = 0, skipped = 0, failed = 0;
+  uint64_t bytesRead = 0;
+  for (int t = 0; t < threads; t++) {
+    compiled += workers[t].compiled;
+    skipped += workers[t].skipped;
+    failed += workers[t].failed;
+    bytesRead += workers[t].bytesRead;
+  }
+  double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+  double megabytes = bytesRead / 1000000.0;
+  cout << "Compiled " << compiled << ", skipped " << skipped << " unchanged, "
+       << failed << " failed: " << files.size() << " files, " << fixed << setprecision(1)
+       << megabytes << " MB in " << setprecision(3) << seconds << " s" << endl;
+  if (seconds > 0) {
+    cout << setprecision(1) << files.size() / seconds << " files/s, " << megabytes / seconds
+         << " MB/s on " << threads << " threads (" << steals << " steals)" << endl;
+  }
+  return failed || unreadable ? 1 : 0;
+}
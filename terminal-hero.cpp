@@ -15,13 +15,136 @@
 \-------------------*/
 int main(int argc, char **argv)
 {
+  clock_gettime(CLOCK_MONOTONIC, &processStart);
   Options options;
+  options.define("b|bench=b", "report CPU usage and load times when the game exits");
+  options.define("no-cache=b", "always compile the chart from the MIDI file");
+  options.define("midifile=b", "compile the chart through smf::MidiFile instead of the event store");
+  options.define("threads=i:0", "threads used to load the MIDI file, 0 for one per core");
+  options.define("load-bench=b", "print per-phase load timings for 1 and N threads, then exit");
+  options.define("check-join=b", "compare the merge join against MidiFile::joinTracks, then exit");
+  options.define("library=s:", "index the MIDI files under this directory, print the songs, then exit");
+  options.define("render=s:", "render the song to this WAV file as fast as possible, then exit");
+  options.define("render-threads=i:1", "render the song this many times at once, to measure synth throughput");
+  options.define("stream=b", "start playing while the MIDI file is still loading");
+  options.define("lookahead=i:2000", "milliseconds of notes a streamed game waits for");
+  options.define("fps=i:60", "frames drawn per second, independent of the simulation");
+  options.define("ansi=b", "draw with raw ANSI escape sequences, one write() per frame, instead of curses");
+  options.define("direct-audio=b", "call fluidsynth from the input loop instead of the audio thread");
+  options.define("render-load=i:0", "busy-wait this many microseconds per frame, to measure under load");
+  options.define("difficulty=s:hard", "easy, medium or hard: how many of the part's notes are charted");
+  options.define("full-soundfont=b", "load every sample of the sound font, not just the presets the song uses");
+  options.define("count-in=i:4", "beats counted in before the notes start, while the sound font loads");
+  options.define("part=i:-1", "MIDI channel the player plays, -1 for every channel but the drums");
+  options.define("no-backing=b", "only play the notes the player hits");
+  options.define("backing-lookahead=i:500", "milliseconds of backing track handed to the synth at a time");
+  options.define("perfect=i:25", "+/- milliseconds for a perfect hit");
+  options.define("great=i:50", "+/- milliseconds for a great hit");
+  options.define("good=i:100", "+/- milliseconds for a good hit");
+  options.define("miss=i:150", "milliseconds early a press breaks a note");
+  options.define("calibrate=b", "measure input and audio latency with a metronome, then exit");
+  options.define("no-calibration=b", "ignore this machine's saved latency calibration");
+  options.define("headless=b", "play the song on a virtual clock without a terminal, then print the judgments");
+  options.define("null-audio=b", "with --headless, send notes nowhere instead of to a synth");
+  options.define("script=s:", "with --headless, read key presses from this file instead of playing perfectly");
   options.process(argc, argv);
-  if (options.getArgCount() == 0) midifile.read("resources/midi-files/twinkle_twinkle.mid");
-  else midifile.read(options.getArg(1));
-  midifile.joinTracks();
-  midifile.doTimeAnalysis();
-  midifile.linkNotePairs();
+
+  // load the chart, from the cache when the MIDI file has been seen before
+  string songFile = "resources/midi-files/twinkle_twinkle.mid";
+  if (options.getArgCount() > 0) songFile = options.getArg(1);
+  useChartCache = !options.getBoolean("no-cache");
+  us_per_frame = 1000000 / (options.getInteger("fps") > 0 ? options.getInteger("fps") : 1);
+  JudgeWindows windows = { options.getInteger("perfect") * 1000LL, options.getInteger("great") * 1000LL,
+                           options.getInteger("good") * 1000LL, options.getInteger("miss") * 1000LL };
+  judge.setWindows(windows);
+  renderLoad_us = options.getInteger("render-load");
+  int part = options.getInteger("part");
+  playerChannels = part >= 0 && part < 16 ? (uint16_t)(1 << part) : (uint16_t)(0xFFFF & ~(1 << DRUM_CHANNEL));
+  int tier = difficultyByName(options.getString("difficulty").c_str());
+  if (tier < 0) {
+    cerr << "Unknown difficulty " << options.getString("difficulty") << ", pick easy, medium or hard" << endl;
+    return 1;
+  }
+  difficulty = tier;
+  bool calibrating = options.getBoolean("calibrate");
+  // the calibration screen is drawn with curses
+  useAnsi = options.getBoolean("ansi") && !calibrating;
+  bool headless = options.getBoolean("headless");
+  // the virtual clock has no latency to make up for
+  if (!calibrating && !headless && !options.getBoolean("no-calibration")) loadCalibration(calibration);
+
+  if (!options.getString("library").empty()) {
+    int threads = options.getInteger("threads") > 0 ? options.getInteger("threads") : hardwareThreads();
+    return printLibrary(options.getString("library"), threads) ? 0 : 1;
+  }
+
+  struct timespec loadStart, loadEnd;
+  string loadKind;
+  clock_gettime(CLOCK_MONOTONIC, &loadStart);
+  string songBytes;
+  if (!readFileBytes(songFile, songBytes)) {
+    cerr << "Could not read MIDI file " << songFile << endl;
+    return 1;
+  }
+  uint64_t songHash = hashBytes(songBytes.data(), songBytes.size());
+  int loadThreads = options.getInteger("threads") > 0 ? options.getInteger("threads") : hardwareThreads();
+  if (options.getBoolean("load-bench")) {
+    return printLoadBenchmark(songBytes, songHash, loadThreads) ? 0 : 1;
+  }
+  if (options.getBoolean("check-join")) {
+    return checkJoin(songBytes) ? 0 : 1;
+  }
+  if (!options.getString("render").empty()) {
+    return renderSong(songBytes, options.getString("render"), options.getInteger("render-threads")) ? 0 : 1;
+  }
+
+  // the sound font loads in the background while the chart is built and
+  // the terminal is set up, reading only the samples the song plays
+  fluid_settings_t* _settings = NULL;
+  fluid_synth_t* _synth = NULL;
+  fluid_audio_driver_t* _adriver = NULL;
+  int _sfont_id;
+  bool onDemandSamples = !options.getBoolean("full-soundfont");
+  if (!headless || !options.getBoolean("null-audio")) {
+    _settings = new_fluid_settings();
+    if (onDemandSamples) setOnDemandSamples(_settings);
+    _synth = new_fluid_synth(_settings);
+    addMappedSoundFontLoader(_synth, _settings);
+    soundFont.start(_synth, SOUND_FONT, onDemandSamples ? &songBytes : NULL);
+  }
+
+  if (useChartCache && mapCachedChart(songHash, chart)) {
+    loadKind = "warm, cached chart";
+  }
+  else if (options.getBoolean("stream") && chartStream.start(songBytes, options.getInteger("lookahead") * 1000LL)) {
+    // play as soon as the lookahead window is in, the rest arrives in update()
+    chart.setSourceHash(songHash);
+    chart.setDivision(chartStream.division());
+    chartStream.waitUntilReady();
+    streaming = chartStream.drainInto(chart);
+    loadKind = "streamed, lookahead window ready";
+  }
+  else if (options.getBoolean("midifile") && compileChartFromBytes(songBytes, songHash, midifile, chart)) {
+    midifile.setFilename(songFile);
+    if (useChartCache) cacheChart(chart);
+    loadKind = "cold, MidiFile pipeline";
+  }
+  else if (!options.getBoolean("midifile") && compileChartFromEvents(songBytes, songHash, events, chart, loadThreads)) {
+    if (useChartCache) cacheChart(chart);
+    loadKind = "cold, compact event store";
+  }
+  else {
+    cerr << "Could not parse MIDI file " << songFile << endl;
+    return 1;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &loadEnd);
+  double loadMs = (loadEnd.tv_sec - loadStart.tv_sec) * 1000.0 + (loadEnd.tv_nsec - loadStart.tv_nsec) / 1000000.0;
+
+  // lanes for every difficulty, worked out before the first note spawns
+  laneMap.reset(playerChannels);
+  laneMap.extend(chart, !streaming);
+  clock_gettime(CLOCK_MONOTONIC, &loadStart);
+  double mapMs = (loadStart.tv_sec - loadEnd.tv_sec) * 1000.0 + (loadStart.tv_nsec - loadEnd.tv_nsec) / 1000000.0;
 
   int tracks = midifile.getTrackCount();
   if (DEBUG) cout << "TPQ: " << midifile.getTicksPerQuarterNote() << endl;
@@ -33,158 +156,241 @@ int main(int argc, char **argv)
       if (DEBUG) cout << dec << midifile[track][event].tick;
       if (DEBUG) cout << '\t' << dec << midifile[track][event].seconds;
       if (DEBUG) cout << '\t';
-      if (midifile[track][event].isNoteOn())
+      if (midifile[track][event].isNoteOn()) {
         if (DEBUG) cout << midifile[track][event].getDurationInSeconds();
-        else if (midifile[track][event].isMeta() && midifile[track][event].isTempo()) {
-          if (DEBUG) cout << midifile[track][event].getTempoBPM();
-          BPM = midifile[track][event].getTempoBPM();
-        }
+      }
+      else if (midifile[track][event].isMeta() && midifile[track][event].isTempo()) {
+        if (DEBUG) cout << midifile[track][event].getTempoBPM();
+      }
       if (DEBUG) cout << '\t' << hex;
-      for (int i = 0; i < midifile[track][event].size(); i++)
+      for (int i = 0; i < (int)midifile[track][event].size(); i++)
         if (DEBUG) cout << (int)midifile[track][event][i] << ' ';
       if (DEBUG) cout << endl;
     }
   }
 
-  // synth variables
-  fluid_settings_t* _settings;
-  fluid_synth_t* _synth;
-  fluid_audio_driver_t* _adriver;
-  int _sfont_id;
-
   // input and note variables
   int _inputChar;
   int _channel = 0;
-  int _note = 48;
   int _velocity = 111;
   int _program = 25;
 
   // Reset to Piano
   _program = 0;
 
-  // Create the synth and apply settings.
-  _settings = new_fluid_settings();
-  _synth = new_fluid_synth(_settings);
+  // play the chosen part on its own channel, so the song's patch changes for
+  // it apply to the player as well
+  if (part >= 0 && part < 16) _channel = part;
+
+  if (headless) {
+    // a synth with no driver still does all the note handling work
+    if (_synth) fluid_synth_program_select(_synth, _channel, soundFont.wait(), 0, _program);
+    bool played = runHeadless(_synth, _channel, options.getString("script"));
+    if (_synth) delete_fluid_synth(_synth);
+    if (_settings) delete_fluid_settings(_settings);
+    return played ? 0 : 1;
+  }
+
+  // everything the player does not play comes from the backing track
+  bool useBacking = !options.getBoolean("no-backing") && backing.load(songBytes, playerChannels, BOARD_HEIGHT - 1, ROWS_PER_QUARTER);
+
+  // init the terminal, our own raw ANSI output or curses
+  if (useAnsi) useAnsi = ansiInit();
+  if (!useAnsi) cursesInit();
+
+  // the board counts the player in while the sound font finishes loading,
+  // the audio driver only starts once it has
+  draw_board();
+  bool playing = calibrating || countIn(options.getInteger("count-in"));
+  _sfont_id = soundFont.wait();
   _adriver = new_fluid_audio_driver(_settings, _synth);
-  _sfont_id = fluid_synth_sfload(_synth, "resources/sound-fonts/Masterpiece.sf2", 1);
 
   // Channel 1 program
   fluid_synth_program_select(_synth, _channel, _sfont_id, 0, _program);
 
-  // init curses
-  cursesInit();
-
   // do our own initialization
   terminalHeroInit();
 
+  if (calibrating) {
+    TapEstimate visual, audible;
+    bool measured = runCalibration(_synth, visual, audible);
+    delete_fluid_audio_driver(_adriver);
+    delete_fluid_synth(_synth);
+    delete_fluid_settings(_settings);
+    endwin();
+
+    if (!measured) {
+      std::cout << "Calibration cancelled or too few steady taps, nothing saved" << std::endl;
+      return 1;
+    }
+    std::cout << fixed << setprecision(1);
+    std::cout << "Visual taps: " << visual.offset_us / 1000.0 << " ms late, spread " << visual.spread_us / 1000.0
+              << " ms, " << visual.used << " used, " << visual.rejected << " rejected" << std::endl;
+    std::cout << "Audio taps:  " << audible.offset_us / 1000.0 << " ms late, spread " << audible.spread_us / 1000.0
+              << " ms, " << audible.used << " used, " << audible.rejected << " rejected" << std::endl;
+    std::cout << "Input offset " << calibration.input_us / 1000.0 << " ms, audio offset "
+              << calibration.audio_us / 1000.0 << " ms" << std::endl;
+    // once the offsets are gone what is left is the player's own jitter
+    double spread_ms = (visual.spread_us > audible.spread_us ? visual.spread_us : audible.spread_us) / 1000.0;
+    std::cout << "Tap spread " << spread_ms << " ms, windows down to --perfect=" << (int)ceil(2 * spread_ms)
+              << " hold most hits" << std::endl;
+    if (saveCalibration(calibration)) std::cout << "Saved to " << calibrationPath() << std::endl;
+    else std::cout << "Could not save the calibration" << std::endl;
+    return 0;
+  }
+
+  // from here on the synth is only driven from the audio thread
+  if (useBacking) useBacking = backing.start(_synth, microsSince(beginningOfTime), options.getInteger("backing-lookahead") * 1000LL);
+  if (useBacking && !options.getBoolean("direct-audio")) audio.setBacking(&backing);
+  bool audioThreaded = !options.getBoolean("direct-audio") && audio.start(_synth, beginningOfTime);
+
   /*-------------------\
   |----- MAIN LOOP ----|
   \-------------------*/
-  while (true) {
+  while (playing) {
     // clock keeping
     clock_gettime(CLOCK_MONOTONIC, &loopEndTime);
-    clock_gettime(CLOCK_MONOTONIC, &nowTime);
+    nowTime = loopEndTime;
     delta_us = (loopEndTime.tv_sec - loopStartTime.tv_sec) * 1000000 + (loopEndTime.tv_nsec - loopStartTime.tv_nsec) / 1000;
-    now = (nowTime.tv_sec - beginningOfTime.tv_sec) * 1000 + (nowTime.tv_nsec - beginningOfTime.tv_nsec) / 1000000;
-    clock_gettime(CLOCK_MONOTONIC, &loopStartTime);
+    now_us = (nowTime.tv_sec - beginningOfTime.tv_sec) * 1000000 + (nowTime.tv_nsec - beginningOfTime.tv_nsec) / 1000;
+    now = now_us / 1000;
+    loopStartTime = loopEndTime;
+
+    // the board runs behind by the audio latency so it matches the backing
+    int64_t board_us = now_us - calibration.audio_us;
 
     // doesn't seem to be needed
     // refresh();
 
-    // ms per update
-    if (now - frameStart > ms_per_update) {
-      // print debug info about frames per second
-      attrset(COLOR_PAIR(0)); // DEFAULT
-      if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 0, 0, "nSeconds per getch():\t%" PRIu64 "       ", delta_us);
+    // simulate in fixed steps up to now, however often the loop wakes up
+    while (simTime_us + SIM_STEP_US <= board_us) {
+      simTime_us += SIM_STEP_US;
+      simulationSteps++;
+      // print debug info about wakeups
+      if (DEBUG) attrset(COLOR_PAIR(0)); // DEFAULT
+      if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 0, 0, "uSeconds per wakeup:\t%" PRIu64 "       ", delta_us);
       if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 1, 0, "Now in milliseconds:\t%" PRIu64 "      ", now);
 
-      // update frameStartTime
-      clock_gettime(CLOCK_MONOTONIC, &frameStartTime);
-      frameStart = now;
-
       // call our update function
-      update(); // this also resets the counter
+      update(simTime_us);
+
+      // notes nobody played are missed the moment their window closes
+      if (judge.expire(simTime_us)) streak = 0;
     }
 
-    // wait for keyboard input
-    _inputChar = getch();
+    // without the audio thread the note offs are sent from here
+    if (!audioThreaded) {
+      directNoteOffs.advance(now_us, _synth);
+      directVoices.sample(_synth, now_us);
+      if (useBacking) backing.pump(now_us);
+    }
 
-    // [Q]UIT on 'q' press
-    if (_inputChar == 'q') {
-      clear();
-      refresh();
-      break;
+    // render at its own rate, skipping frames rather than queueing them
+    if (now_us >= nextFrame_us) {
+      render(board_us);
+      nextFrame_us += us_per_frame;
+      if (nextFrame_us <= now_us) nextFrame_us = now_us + us_per_frame;
     }
 
-    /* test input char */
-    switch (_inputChar) {
-    case KEY_LEFT:
-    case 'a':
-    case 'A':
-      _note = 48;
-      if (a_column[0]) {
-        playNote(_synth, _channel, a_column[0], _velocity);
-      }
-      else {
-        streak = 0;
-      }
-      break;
-
-    case KEY_DOWN:
-    case 's':
-    case 'S':
-      _note = 50;
-      if (s_column[0]) {
-        playNote(_synth, _channel, s_column[0], _velocity);
-      }
-      else {
-        streak = 0;
-      }
-      break;
-
-    case KEY_UP:
-    case 'd':
-    case 'D':
-      _note = 51;
-      if (d_column[0]) {
-        playNote(_synth, _channel, d_column[0], _velocity);
-      }
-      else {
-        streak = 0;
-      }
-      break;
-
-    case KEY_RIGHT:
-    case 'f':
-    case 'F':
-      _note = 55;
-      if (f_column[0]) {
-        playNote(_synth, _channel, f_column[0], _velocity);
-      }
-      else {
-        streak = 0;
+    // sleep until a key arrives or the next update is due
+    waitForInputOrUpdate();
+
+    // handle every key that arrived while we were asleep
+    while (playing && (_inputChar = readKey()) != ERR) {
+      // [Q]UIT on 'q' press
+      if (_inputChar == 'q') {
+        if (!useAnsi) {
+          clear();
+          refresh();
+        }
+        playing = false;
+        break;
       }
-      break;
 
-    // -1 represents no character, skip playing note
-    case -1:
-      continue;
+      // judge the press at the moment it was read, not at the next row
+      clock_gettime(CLOCK_MONOTONIC, &nowTime);
+      int64_t press_us = (nowTime.tv_sec - beginningOfTime.tv_sec) * 1000000 + (nowTime.tv_nsec - beginningOfTime.tv_nsec) / 1000;
 
-    default:
-      continue;
+      /* test input char */
+      int lane = laneForKey(_inputChar);
+      if (lane >= 0) hitLane(_synth, _channel, lane, press_us, _velocity, wallClock);
+      inputPathLatency.record(microsSince(beginningOfTime) - press_us);
     }
   }
 
   /* Clean up fluidsynth */
+  audio.stop();
   delete_fluid_audio_driver(_adriver);
+  backing.stop();
   delete_fluid_synth(_synth);
   delete_fluid_settings(_settings);
 
-  /* Clean up curses */
-  endwin();
+  /* Clean up the terminal */
+  if (useAnsi) ansi.end();
+  else endwin();
 
   /* Say Goodbye */
   std::cout << std::endl <<  "Thanks for playing!" << std::endl;
+  std::cout << "Perfect " << judge.count(JUDGE_PERFECT) << ", great " << judge.count(JUDGE_GREAT)
+            << ", good " << judge.count(JUDGE_GOOD) << ", miss " << judge.count(JUDGE_MISS) << std::endl;
+
+  /* Benchmark report */
+  if (options.getBoolean("bench")) {
+    std::cout << "Chart load: " << fixed << setprecision(3) << loadMs << " ms ("
+              << loadKind << ", " << chart.size() << " notes)" << std::endl;
+    std::cout << "Lane map: " << fixed << setprecision(3) << mapMs << " ms (";
+    for (int tier = 0; tier < DIFFICULTY_COUNT; tier++) {
+      std::cout << (tier ? ", " : "") << DIFFICULTY_TIERS[tier].name << " " << laneMap.notes(tier);
+    }
+    std::cout << " notes" << (streaming ? " so far" : "") << ")" << std::endl;
+    if (events.getEventCount()) {
+      std::cout << "Event store: " << events.getEventCount() << " events in "
+                << events.memoryUsage() << " bytes" << std::endl;
+    }
+    std::cout << "Startup: sound font " << setprecision(1) << soundFont.load_ms() << " ms in the background, first frame "
+              << firstFrame_us / 1000.0 << " ms, first note ";
+    if (firstNote_us >= 0) std::cout << firstNote_us / 1000.0 << " ms" << std::endl;
+    else std::cout << "none" << std::endl;
+    if (onDemandSamples) {
+      std::cout << "Sound font: mapped, samples on demand, " << soundFont.pinned() << " of "
+                << soundFont.presets() << " song presets pinned" << std::endl;
+    } else {
+      std::cout << "Sound font: mapped, every sample loaded" << std::endl;
+    }
+    double seconds = now_us / 1000000.0;
+    if (seconds > 0) {
+      std::cout << "Frames:    " << framesRendered << " (" << setprecision(1) << framesRendered / seconds << " fps), "
+                << simulationSteps << " simulation steps, " << simulationRows << " rows" << std::endl;
+    }
+    const LatencyStats& noteOns = audioThreaded ? audio.noteOnLatency() : directNoteOnLatency;
+    std::cout << "Press to noteon (" << (audioThreaded ? "audio thread" : "direct") << "): "
+              << noteOns.count() << " notes, mean " << setprecision(1) << noteOns.mean() << " us, p99 "
+              << noteOns.percentile(0.99) << " us, max " << noteOns.max() << " us" << std::endl;
+    std::cout << "Input path: " << inputPathLatency.count() << " keys, mean " << inputPathLatency.mean() << " us, p99 "
+              << inputPathLatency.percentile(0.99) << " us, max " << inputPathLatency.max() << " us" << std::endl;
+    const NoteOffScheduler& noteOffs = audioThreaded ? audio.noteOffs() : directNoteOffs;
+    const VoiceStats& voices = audioThreaded ? audio.voices() : directVoices;
+    std::cout << "Note offs: " << noteOffs.scheduled() << " scheduled, " << noteOffs.sent() << " sent, peak "
+              << noteOffs.peakPending() << " pending" << std::endl;
+    std::cout << "Voices: peak " << voices.peak() << ", mean " << voices.mean() << " over "
+              << voices.samples() << " samples" << std::endl;
+    std::cout << setprecision(1) << "Frame time (" << (useAnsi ? "ansi" : "curses") << "): mean " << frameTimes.mean()
+              << " us, p99 " << frameTimes.percentile(0.99) << " us, max " << frameTimes.max() << " us" << std::endl;
+    if (useAnsi && ansi.frames()) {
+      std::cout << "ANSI output: " << ansi.bytes() << " bytes in " << ansi.frames() << " frames with changes, "
+                << setprecision(2) << (double)ansi.writes() / ansi.frames() << " write() calls per frame" << std::endl;
+    }
+    if (seconds > 0) {
+      std::cout << "Screen: " << screen.cellsWritten() << " cells changed in " << screen.runs() << " runs, "
+                << setprecision(0) << screen.cellsWritten() / seconds << " cells/s" << std::endl;
+    }
+    if (useBacking) {
+      std::cout << "Backing: " << backing.size() << " events, " << backing.sent() << " sent in "
+                << backing.batches() << " batches" << std::endl;
+    }
+    if (audio.dropped()) std::cout << "Audio queue full, " << audio.dropped() << " commands dropped" << std::endl;
+    printCpuUsage();
+  }
 
   /* End program successfully */
   return 0;
@@ -193,80 +399,547 @@ int main(int argc, char **argv)
 /*--------------------------\
 |-FUNCTION IMPLEMENTATIONS -|
 \--------------------------*/
-void update(void)
+// Advance the simulation to step_us, one fixed step.
+void update(int64_t step_us)
 {
+  // the board scrolls in whole rows, which only decides where notes are
+  // drawn; nothing is judged on rows
+  while (scroller.due(step_us)) {
+    scroller.advance();
+    board.scrollDown();
+    simulationRows++;
+  }
+
   // make it rain
-  make_it_rain();
+  make_it_rain(step_us);
+}
+
+// Put a note at the top of a lane, it reaches the finish line BOARD_HEIGHT - 1
+// rows from now.  It is judged on its own time delayed by those rows, as the
+// backing track is, not on the row it spawned in.
+void spawnInLane(unsigned int lane, int note, size_t index)
+{
+  if (firstNote_us < 0) firstNote_us = microsSince(processStart);
+  board.spawn(lane, note);
+  judge.add(lane, noteHitTime(chart.tempoMap(), chart.time_us[index], BOARD_HEIGHT - 1), note, index);
+}
+
+// Lane a key plays, -1 if it plays none.
+int laneForKey(int key)
+{
+  static const int ARROWS[4] = { KEY_LEFT, KEY_DOWN, KEY_UP, KEY_RIGHT };
+  for (unsigned int lane = 0; lane < CHART_LANES; lane++) {
+    if (key == LANE_KEYS[lane] || key == toupper(LANE_KEYS[lane])) return lane;
+    if (lane < 4 && key == ARROWS[lane]) return lane;
+  }
+  return -1;
+}
+
+// Grade a key press in lane and play the note it hit on clock.
+void hitLane(fluid_synth_t* synth, int channel, unsigned int lane, int64_t press_us, int velocity, GameClock clock)
+{
+  // judge on the board's clock, at the moment the key really went down
+  JudgeResult result = judge.press(lane, press_us - calibration.audio_us - calibration.input_us);
+  lastJudgment = result;
+  if (result.grade == JUDGE_NONE || result.grade == JUDGE_MISS) {
+    streak = 0;
+    return;
+  }
+  // the chart knows how long the note is, streamed notes may still be 0
+  int64_t duration = chart.duration_us[result.note] > 0 ? chart.duration_us[result.note] : DEFAULT_NOTE_US;
+  playNote(synth, channel, result.key, velocity, press_us, duration, clock);
+  // playNote() scores a good hit, better timing earns more
+  score += BASE_SCORE_INCREMENT * (JUDGE_GOOD - result.grade);
+}
+
+// Draw one lane of the board.  quarter is how far, in quarter rows, the
+// notes have moved towards the next row; the scan line characters place a
+// note inside its cell so it slides down instead of jumping a whole row.
+void drawLane(unsigned int lane, unsigned int x, int color, int quarter)
+{
+  for (unsigned int y = FINISH_LINE - BOARD_HEIGHT; y < FINISH_LINE; y++) screen.put(x, y, ERASE, color);
+  for (unsigned int i = 1; i < BOARD_HEIGHT; i++) {
+    if (!board.occupied(lane, i)) continue;
+    unsigned int y = FINISH_LINE - i;
+    if (quarter == 0) screen.put(x, y, GLYPH_DIAMOND, color);
+    else if (quarter == 1) screen.put(x, y, GLYPH_S7, color);
+    // the finish line keeps its marker, row 1 notes only reach it next row
+    else if (i > 1) screen.put(x, y + 1, quarter == 2 ? GLYPH_S1 : GLYPH_S3, color);
+  }
+  screen.put(x, FINISH_LINE, GLYPH_DIAMOND, color);
+}
+
+// Draw the board as it looks at render_us, between the last simulated row
+// and the next one.  Only cells that changed since the last frame reach
+// curses.
+void render(int64_t render_us)
+{
+  int64_t started_us = microsSince(beginningOfTime);
+  int64_t rowStart = scroller.currentRowTime();
+  int64_t rowLength = scroller.nextRowTime() - rowStart;
+  int64_t into = render_us - rowStart;
+  if (into < 0) into = 0;
+  int quarter = rowLength > 0 && into < rowLength ? (int)(into * 4 / rowLength) : 3;
 
-  //update Scoreboard
+  for (unsigned int lane = 0; lane < CHART_LANES; lane++) drawLane(lane, NOTE_ONE_X + 2 * lane, LANE_COLORS[lane], quarter);
   updateScoreboard();
+  presentScreen();
+  framesRendered++;
+  frameTimes.record(microsSince(beginningOfTime) - started_us);
+
+  // stand-in for a slow terminal
+  if (renderLoad_us > 0) {
+    int64_t until = microsSince(beginningOfTime) + renderLoad_us;
+    while (microsSince(beginningOfTime) < until) { }
+  }
 }
 
-void make_it_rain(void)
+void make_it_rain(int64_t step_us)
 {
-  for (int i = 0; i < BOARD_HEIGHT - 1; i++) {
-    a_column[i] = a_column[i + 1];
-    if (a_column[i] > 0) {
-      mvaddch(FINISH_LINE - i - 1, NOTE_ONE_X, ERASE);
-      attrset(COLOR_PAIR(2));
-      mvaddch(FINISH_LINE - i, NOTE_ONE_X, ACS_DIAMOND);
+  // pick up notes the loader has decoded since the last update
+  if (streaming) {
+    if (!chartStream.drainInto(chart)) {
+      streaming = false;
+      if (useChartCache && !chartStream.failed()) cacheChart(chart);
     }
+    laneMap.extend(chart, !streaming);
+  }
+
+  // spawn every note that is due by this step, the chart is in time order
+  size_t due = dueNotes(chart, chartCursor, step_us + SPAWN_SLACK_US);
+  // a streamed chord still waiting for its last notes spawns once it is mapped
+  if (due > laneMap.mapped()) due = laneMap.mapped();
+  for (; chartCursor < due; chartCursor++) {
+    // other parts and notes the difficulty leaves out are not charted
+    int lane = laneMap.lane(difficulty, chartCursor);
+    if (lane == LANE_NONE) continue;
 
+    int note = chart.key[chartCursor];
+    if (DEBUG) attrset(COLOR_PAIR(0)); // DEFAULT
+    if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 3, 0, "Midi Note On:\t%d       ", note);
+    if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 2, 0, "Midi Event at:\t%" PRId64 "   us", chart.time_us[chartCursor]);
+
+    // two onsets can share a row, the first one keeps it; the note's own row
+    // decides, so the outcome never depends on when the steps ran
+    int64_t row = noteRow(chart.tempoMap(), chart.time_us[chartCursor]);
+    if (row <= spawnRow[lane]) continue;
+    spawnRow[lane] = row;
+    spawnInLane(lane, note, chartCursor);
+  }
+}
+
+// Block until stdin is readable, the simulation step holding the next row
+// has passed on the board's clock or the next frame is due.
+int waitForInputOrUpdate(void)
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  int64_t current = (t.tv_sec - beginningOfTime.tv_sec) * 1000000 + (t.tv_nsec - beginningOfTime.tv_nsec) / 1000;
+  int64_t rowStep = (scroller.nextRowTime() + SIM_STEP_US - 1) / SIM_STEP_US * SIM_STEP_US + calibration.audio_us;
+  int64_t deadline = rowStep < nextFrame_us ? rowStep : nextFrame_us;
+  if (!audio.running()) {
+    int64_t noteOff = directNoteOffs.nextDeadline();
+    if (noteOff >= 0 && noteOff < deadline) deadline = noteOff;
   }
+  int64_t remaining = deadline - current;
+  if (remaining < 0) remaining = 0;
+
+  struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+#ifdef __linux__
+  // wake on the row's microsecond rather than the millisecond after it
+  struct timespec timeout = { (time_t)(remaining / 1000000), (long)(remaining % 1000000) * 1000 };
+  return ppoll(&input, 1, &timeout, NULL);
+#else
+  // poll() only has milliseconds, round up so we never wake early
+  return poll(&input, 1, (int)((remaining + 999) / 1000));
+#endif
+}
+
+// Print how much CPU the process used relative to the time it was running.
+void printCpuUsage(void)
+{
+  struct rusage usage;
+  struct timespec t;
+  getrusage(RUSAGE_SELF, &usage);
+  clock_gettime(CLOCK_MONOTONIC, &t);
+
+  double user = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1000000.0;
+  double sys = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1000000.0;
+  double wall = (t.tv_sec - beginningOfTime.tv_sec) + (t.tv_nsec - beginningOfTime.tv_nsec) / 1000000000.0;
 
-  for (int i = 0; i < BOARD_HEIGHT - 1; i++) {
-    s_column[i] = s_column[i + 1];
-    if (s_column[i] > 0) {
-      mvaddch(FINISH_LINE - i - 1, NOTE_TWO_X, ERASE);
-      attrset(COLOR_PAIR(1));
-      mvaddch(FINISH_LINE - i, NOTE_TWO_X, ACS_DIAMOND);
+  std::cout << fixed << setprecision(3);
+  std::cout << "CPU user:  " << user << " s" << std::endl;
+  std::cout << "CPU sys:   " << sys << " s" << std::endl;
+  std::cout << "Wall time: " << wall << " s" << std::endl;
+  if (wall > 0) std::cout << "CPU usage: " << setprecision(2) << 100.0 * (user + sys) / wall << " %" << std::endl;
+
+#ifdef __APPLE__
+  long peakKb = usage.ru_maxrss / 1024;  // bytes on macOS
+#else
+  long peakKb = usage.ru_maxrss;         // kilobytes on Linux
+#endif
+  std::cout << "Peak RSS:  " << peakKb << " KB" << std::endl;
+
+#ifdef __linux__
+  // what this process holds now, anonymous memory (the loaded samples among
+  // it) is its own, file pages are shared with other processes
+  FILE* status = fopen("/proc/self/status", "r");
+  if (status) {
+    char line[128];
+    long rss = -1, anon = -1, file = -1;
+    while (fgets(line, sizeof(line), status)) {
+      sscanf(line, "VmRSS: %ld", &rss);
+      sscanf(line, "RssAnon: %ld", &anon);
+      sscanf(line, "RssFile: %ld", &file);
     }
+    fclose(status);
+    if (rss >= 0) std::cout << "RSS:       " << rss << " KB (" << anon << " KB anonymous, " << file << " KB file)" << std::endl;
   }
+#endif
+}
 
-  for (int i = 0; i < BOARD_HEIGHT - 1; i++) {
-    d_column[i] = d_column[i + 1];
-    if (d_column[i] > 0) {
-      mvaddch(FINISH_LINE - i - 1, NOTE_THREE_X, ERASE);
-      attrset(COLOR_PAIR(3));
-      mvaddch(FINISH_LINE - i, NOTE_THREE_X, ACS_DIAMOND);
+// Load the song with one thread and with threads threads, best of a few
+// runs each, and print how long every phase took.
+bool printLoadBenchmark(const string& songBytes, uint64_t songHash, int threads)
+{
+  const int RUNS = 5;
+  int configs[2] = { 1, threads };
+
+  std::cout << "Threads\tDecode\tTempo\tLink\tMerge\tTotal (ms, best of " << RUNS << ")" << std::endl;
+  for (int c = 0; c < 2; c++) {
+    LoadTimings best = { 0, 0, 0, 0 };
+    double bestTotal = -1;
+    for (int run = 0; run < RUNS; run++) {
+      EventStore runEvents;
+      NoteChart runChart;
+      LoadTimings timings = { 0, 0, 0, 0 };
+      if (!compileChartFromEvents(songBytes, songHash, runEvents, runChart, configs[c], &timings)) {
+        cerr << "Could not parse MIDI file" << endl;
+        return false;
+      }
+      double total = timings.decode_ms + timings.tempo_ms + timings.link_ms + timings.merge_ms;
+      if (bestTotal < 0 || total < bestTotal) {
+        best = timings;
+        bestTotal = total;
+      }
     }
+    std::cout << fixed << setprecision(3) << configs[c] << '\t' << best.decode_ms << '\t' << best.tempo_ms
+              << '\t' << best.link_ms << '\t' << best.merge_ms << '\t' << bestTotal << std::endl;
   }
+  return true;
+}
 
-  for (int i = 0; i < BOARD_HEIGHT - 1; i++) {
-    f_column[i] = f_column[i + 1];
-    if (f_column[i] > 0) {
-      mvaddch(FINISH_LINE - i - 1, NOTE_FOUR_X, ERASE);
-      attrset(COLOR_PAIR(4));
-      mvaddch(FINISH_LINE - i, NOTE_FOUR_X, ACS_DIAMOND);
+// Join the song with MidiFile::joinTracks() and with the k-way merge join,
+// and make sure both produce the same events in the same order.
+bool checkJoin(const string& songBytes)
+{
+  MidiFile sorted;
+  MergeJoinMidiFile merged;
+  istringstream sortedStream(songBytes), mergedStream(songBytes);
+  if (!sorted.read(sortedStream) || !merged.read(mergedStream)) {
+    cerr << "Could not parse MIDI file" << endl;
+    return false;
+  }
+
+  struct timespec start, middle, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  sorted.joinTracks();
+  clock_gettime(CLOCK_MONOTONIC, &middle);
+  merged.joinTracks();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  std::cout << fixed << setprecision(3);
+  std::cout << "joinTracks (sort):  " << (middle.tv_sec - start.tv_sec) * 1000.0 + (middle.tv_nsec - start.tv_nsec) / 1000000.0 << " ms" << std::endl;
+  std::cout << "joinTracks (merge): " << (end.tv_sec - middle.tv_sec) * 1000.0 + (end.tv_nsec - middle.tv_nsec) / 1000000.0 << " ms" << std::endl;
+
+  int difference = firstJoinDifference(sorted, merged);
+  if (difference >= 0) {
+    std::cout << "MISMATCH at joined event " << difference << std::endl;
+    return false;
+  }
+  std::cout << "OK, " << merged[0].size() << " events identical" << std::endl;
+  return true;
+}
+
+// Bring the song index of the library at root up to date and print it, the
+// way a song picker would see it.
+bool printLibrary(const string& root, int threads)
+{
+  string indexFile = songIndexPath(root);
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  SongIndex index;
+  bool loaded = !indexFile.empty() && index.load(indexFile);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double loadMs = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+  SongIndexStats stats;
+  if (!index.update(root, threads, &stats)) {
+    cerr << "Could not read library " << root << endl;
+    return false;
+  }
+  if (indexFile.empty() || !index.save(indexFile)) cerr << "Could not save the song index" << endl;
+
+  std::cout << "Length\tNotes\tPeak/s\tBPM\tTracks\tSong" << std::endl;
+  for (size_t song = 0; song < index.size(); song++) {
+    const SongInfo& info = index[song];
+    if (info.flags & SONG_UNREADABLE) {
+      std::cout << "-\t-\t-\t-\t-\t" << index.path(song) << std::endl;
+      continue;
+    }
+    int64_t seconds = info.duration_us / 1000000;
+    std::cout << seconds / 60 << ':' << setfill('0') << setw(2) << seconds % 60 << setfill(' ') << '\t'
+              << info.notes << '\t' << info.peakNotesPerSecond << '\t'
+              << fixed << setprecision(0);
+    // a song with nothing in it can have no tempo at all
+    if (info.slowestTempo) std::cout << 60000000.0 / info.slowestTempo;
+    else std::cout << '-';
+    if (info.fastestTempo && info.fastestTempo != info.slowestTempo) std::cout << '-' << 60000000.0 / info.fastestTempo;
+    std::cout << '\t' << info.tracks << '\t' << index.path(song) << std::endl;
+  }
+
+  std::cout << fixed << setprecision(3) << "Index: " << stats.files << " songs, " << stats.parsed << " parsed, "
+            << stats.unchanged << " unchanged, " << stats.removed << " removed" << std::endl;
+  std::cout << "Index load " << loadMs << " ms" << (loaded ? "" : " (no index yet)") << ", scan " << stats.scan_ms
+            << " ms, parse " << stats.parse_ms << " ms on " << threads << " threads" << std::endl;
+  return true;
+}
+
+// Render the whole song, every channel, to wavFile without an audio driver.
+// With more than one worker the song is rendered that many times at once and
+// only the first copy is kept, which measures how the synth scales.
+bool renderSong(const string& songBytes, const string& wavFile, int workers)
+{
+  BackingTrack song;
+  if (!song.load(songBytes, 0, 0, ROWS_PER_QUARTER)) {
+    cerr << "Could not parse MIDI file" << endl;
+    return false;
+  }
+  if (workers < 1) workers = 1;
+
+  std::vector<RenderStats> stats(workers);
+  std::vector<char> rendered(workers, 0);
+  std::vector<int16_t> samples;
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  parallelFor(workers, workers, [&](int i) {
+    rendered[i] = renderOffline(song.events(), SOUND_FONT, RENDER_SAMPLE_RATE, i == 0 ? &samples : NULL, stats[i]);
+  });
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+  for (int i = 0; i < workers; i++) {
+    if (!rendered[i]) {
+      cerr << "Could not create a synth with " << SOUND_FONT << endl;
+      return false;
+    }
+  }
+  if (!writeWavFile(wavFile, samples, RENDER_SAMPLE_RATE)) {
+    cerr << "Could not write " << wavFile << endl;
+    return false;
+  }
+
+  double song_ms = stats[0].frames * 1000.0 / RENDER_SAMPLE_RATE;
+  std::cout << fixed << setprecision(1);
+  std::cout << "Rendered " << song.size() << " events, " << song_ms / 1000.0 << " s of audio to " << wavFile << std::endl;
+  std::cout << "Soundfont load: " << stats[0].load_ms << " ms, render: " << stats[0].render_ms << " ms, "
+            << (stats[0].render_ms > 0 ? song_ms / stats[0].render_ms : 0) << "x real time" << std::endl;
+  if (workers > 1) {
+    double slowest = 0;
+    for (int i = 0; i < workers; i++) if (stats[i].render_ms > slowest) slowest = stats[i].render_ms;
+    std::cout << workers << " workers: " << wall_ms << " ms wall, slowest render " << slowest << " ms, "
+              << (wall_ms > 0 ? workers * song_ms / wall_ms : 0) << "x real time together" << std::endl;
+  }
+  return true;
+}
+
+// Key presses for --headless --script: one "<milliseconds> <lane>" per line,
+// lane a number from 0 or its key in LANE_KEYS, in time order.  # starts a
+// comment.
+static bool readPressScript(const string& filename, std::vector<std::pair<int64_t, unsigned int> >& presses)
+{
+  std::ifstream input(filename.c_str());
+  if (!input) return false;
+  string line;
+  int lineNumber = 0;
+  while (std::getline(input, line)) {
+    lineNumber++;
+    size_t comment = line.find('#');
+    if (comment != string::npos) line.erase(comment);
+    istringstream fields(line);
+    double ms;
+    string lane;
+    if (!(fields >> ms)) continue;
+    size_t index = lane.npos;
+    if (fields >> lane && lane.size() == 1) index = string(LANE_KEYS, CHART_LANES).find(tolower(lane[0]));
+    if (index == string::npos && lane.size() == 1 && lane[0] >= '0' && lane[0] < '0' + (int)CHART_LANES) index = lane[0] - '0';
+    if (index == string::npos) {
+      cerr << filename << ":" << lineNumber << ": expected a time and a lane" << endl;
+      return false;
+    }
+    presses.push_back(std::make_pair((int64_t)llround(ms * 1000), (unsigned int)index));
+  }
+  std::stable_sort(presses.begin(), presses.end(),
+                   [](const std::pair<int64_t, unsigned int>& a, const std::pair<int64_t, unsigned int>& b) { return a.first < b.first; });
+  return true;
+}
+
+// Play the whole chart on a virtual clock, as fast as the simulation runs,
+// with no terminal.  Presses come from script, or from a bot that hits
+// every note on its exact time when script is empty.  Prints every
+// judgment, the tallies and how fast the simulation ran.  With a synth it
+// also waits for every note off and fails if a note is still sounding.
+bool runHeadless(fluid_synth_t* synth, int channel, const string& script)
+{
+  std::vector<std::pair<int64_t, unsigned int> > presses;
+  if (!script.empty() && !readPressScript(script, presses)) {
+    cerr << "Could not read press script " << script << endl;
+    return false;
+  }
+  std::vector<JudgeRecord> log;
+  judge.setLog(&log);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  scroller.reset();
+  simTime_us = 0;
+  size_t nextPress = 0;
+  int64_t lastNote_us = -1;
+  while (true) {
+    simTime_us += SIM_STEP_US;
+    simulationSteps++;
+    update(simTime_us);
+
+    // presses land on their own microsecond, not on the step
+    if (script.empty()) {
+      for (unsigned int lane = 0; lane < CHART_LANES; lane++) {
+        int64_t hit_us;
+        while ((hit_us = judge.nextHit(lane)) >= 0 && hit_us <= simTime_us) hitLane(synth, channel, lane, hit_us, 111, headlessClock);
+      }
+    } else {
+      for (; nextPress < presses.size() && presses[nextPress].first <= simTime_us; nextPress++) {
+        hitLane(synth, channel, presses[nextPress].second, presses[nextPress].first, 111, headlessClock);
+      }
+    }
+    if (judge.expire(simTime_us)) streak = 0;
+    if (synth) directNoteOffs.advance(simTime_us, synth);
+
+    // done once every note has spawned and been judged
+    bool judging = false;
+    for (unsigned int lane = 0; lane < CHART_LANES; lane++) judging = judging || judge.nextHit(lane) >= 0;
+    if (!streaming && chartCursor >= chart.size() && !judging) {
+      if (lastNote_us < 0) lastNote_us = simTime_us;
+      // let the last notes ring out so the synth does the whole song's work
+      if (!synth || directNoteOffs.pending() == 0 || simTime_us >= lastNote_us + HEADLESS_RING_OUT_US) break;
     }
   }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1000000000.0;
+  judge.setLog(NULL);
+
+  static const char* names[JUDGE_COUNT] = { "perfect", "great", "good", "miss" };
+  std::cout << "Hit ms\tLane\tKey\tJudgment\tOffset ms" << std::endl;
+  std::cout << fixed << setprecision(3);
+  for (size_t i = 0; i < log.size(); i++) {
+    std::cout << log[i].hit_us / 1000.0 << '\t' << log[i].lane << '\t' << log[i].result.key << '\t'
+              << names[log[i].result.grade] << '\t' << log[i].result.offset_us / 1000.0 << std::endl;
+  }
+  std::cout << "Score " << score << ", perfect " << judge.count(JUDGE_PERFECT) << ", great " << judge.count(JUDGE_GREAT)
+            << ", good " << judge.count(JUDGE_GOOD) << ", miss " << judge.count(JUDGE_MISS) << std::endl;
+  std::cout << setprecision(1) << simTime_us / 1000000.0 << " s of song in " << setprecision(3) << wall * 1000.0
+            << " ms: " << simulationSteps << " steps, " << simulationRows << " rows, " << setprecision(0)
+            << (wall > 0 ? simulationSteps / wall : 0) << " steps/s, "
+            << (wall > 0 ? simTime_us / 1000000.0 / wall : 0) << "x real time" << std::endl;
+
+  // every note played must have been released on the virtual clock
+  if (synth) {
+    size_t sounding = directNoteOffs.pending();
+    std::cout << "Note offs: " << directNoteOffs.scheduled() << " scheduled, " << directNoteOffs.sent() << " sent, "
+              << sounding << " still sounding" << (sounding ? "  FAILED" : "") << std::endl;
+    if (sounding) return false;
+  }
+  return true;
+}
+
+// Tap along to CLICK_TAPS metronome beats, after CLICK_LEAD_IN to settle in,
+// either heard (audible) or seen as a flash.  offsets gets how late each tap
+// was against the nearest beat.  False if the player quit with 'q'.
+bool collectTaps(fluid_synth_t* synth, bool audible, std::vector<int64_t>& offsets)
+{
+  const int BEATS = CLICK_LEAD_IN + CLICK_TAPS;
+  const unsigned int FLASH_Y = BOARD_START_Y + BOARD_HEIGHT / 2;
+
+  clear();
+  attrset(COLOR_PAIR(7));
+  mvprintw(BOARD_START_Y, BOARD_START_X, "Latency calibration, %s", audible ? "listen" : "watch");
+  mvprintw(BOARD_START_Y + 2, BOARD_START_X, audible ? "Tap any key on every click you hear."
+                                                     : "Tap any key every time the block flashes.");
+  mvprintw(BOARD_START_Y + 3, BOARD_START_X, "The first %d beats are for finding the rhythm, Q quits.", CLICK_LEAD_IN);
+  refresh();
+
+  int64_t start_us = microsSince(beginningOfTime) + 1000000;
+  int64_t end_us = start_us + (BEATS - 1) * CLICK_INTERVAL_US + CLICK_INTERVAL_US / 2;
+  int64_t flashOff_us = -1;
+  int beat = 0;
+  while (true) {
+    int64_t current = microsSince(beginningOfTime);
+    if (current >= end_us) break;
 
-  a_column[BOARD_HEIGHT - 1] = 0;
-  s_column[BOARD_HEIGHT - 1] = 0;
-  d_column[BOARD_HEIGHT - 1] = 0;
-  f_column[BOARD_HEIGHT - 1] = 0;
-
-  int note = spawnNote();
-  while (note) {
-    if (note % 4 == 0) {
-      if (a_column[BOARD_HEIGHT - 1] == 0) a_column[BOARD_HEIGHT - 1] = note;
-      else if (s_column[BOARD_HEIGHT - 1] == 0) s_column[BOARD_HEIGHT - 1] = note;
-      else if (d_column[BOARD_HEIGHT - 1] == 0) d_column[BOARD_HEIGHT - 1] = note;
-    } else if (note % 4 == 1) {
-      if (s_column[BOARD_HEIGHT - 1] == 0) s_column[BOARD_HEIGHT - 1] = note;
-      else if (d_column[BOARD_HEIGHT - 1] == 0) d_column[BOARD_HEIGHT - 1] = note;
-      else if (f_column[BOARD_HEIGHT - 1] == 0) f_column[BOARD_HEIGHT - 1] = note;
-    } else if (note % 4 == 2) {
-      if (d_column[BOARD_HEIGHT - 1] == 0) d_column[BOARD_HEIGHT - 1] = note;
-      else if (f_column[BOARD_HEIGHT - 1] == 0) f_column[BOARD_HEIGHT - 1] = note;
-      else a_column[BOARD_HEIGHT - 1] = note;
-    } else if (note % 4 == 3) {
-      if (f_column[BOARD_HEIGHT - 1] == 0) f_column[BOARD_HEIGHT - 1] = note;
-      else if (a_column[BOARD_HEIGHT - 1] == 0) a_column[BOARD_HEIGHT - 1] = note;
-      else if (s_column[BOARD_HEIGHT - 1] == 0) s_column[BOARD_HEIGHT - 1] = note;
+    // clicks go straight to the synth, the audio thread is not running
+    if (beat < BEATS && current >= start_us + beat * CLICK_INTERVAL_US) {
+      if (audible) {
+        fluid_synth_noteoff(synth, DRUM_CHANNEL, CLICK_KEY);
+        fluid_synth_noteon(synth, DRUM_CHANNEL, CLICK_KEY, 120);
+      } else {
+        attrset(COLOR_PAIR(5)); // CYAN
+        mvprintw(FLASH_Y, BOARD_START_X, "########");
+        flashOff_us = start_us + beat * CLICK_INTERVAL_US + FLASH_US;
+      }
+      attrset(COLOR_PAIR(7));
+      mvprintw(FLASH_Y + 2, BOARD_START_X, "Beat %2d / %d  taps %2d", beat + 1, BEATS, (int)offsets.size());
+      refresh();
+      beat++;
+    }
+    if (flashOff_us >= 0 && current >= flashOff_us) {
+      mvprintw(FLASH_Y, BOARD_START_X, "        ");
+      refresh();
+      flashOff_us = -1;
+    }
+
+    // sleep until a key, the next beat or the end of the flash
+    int64_t deadline = beat < BEATS ? start_us + beat * CLICK_INTERVAL_US : end_us;
+    if (flashOff_us >= 0 && flashOff_us < deadline) deadline = flashOff_us;
+    int64_t remaining = deadline - microsSince(beginningOfTime);
+    struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+    poll(&input, 1, remaining > 0 ? (int)((remaining + 999) / 1000) : 0);
+
+    int key;
+    while ((key = getch()) != ERR) {
+      if (key == 'q' || key == 'Q') return false;
+      int64_t tap_us = microsSince(beginningOfTime);
+      // nearest beat, taps before the first one round towards it
+      int64_t since = tap_us - start_us + CLICK_INTERVAL_US / 2;
+      if (since < 0) continue;
+      int64_t nearest = since / CLICK_INTERVAL_US;
+      if (nearest >= CLICK_LEAD_IN && nearest < BEATS) offsets.push_back(tap_us - (start_us + nearest * CLICK_INTERVAL_US));
     }
-    note = spawnNote();
   }
+  if (audible) fluid_synth_noteoff(synth, DRUM_CHANNEL, CLICK_KEY);
+  return true;
+}
+
+// Tap to flashes, which are late by the input and display path alone, then
+// to clicks, which are late by that plus the audio path.  The difference is
+// the audio offset.  Sets the global calibration when both phases held up.
+bool runCalibration(fluid_synth_t* synth, TapEstimate& visual, TapEstimate& audible)
+{
+  std::vector<int64_t> visualTaps, audibleTaps;
+  if (!collectTaps(synth, false, visualTaps) || !collectTaps(synth, true, audibleTaps)) return false;
+  if (!estimateTapOffset(visualTaps, visual) || !estimateTapOffset(audibleTaps, audible)) return false;
+
+  calibration.input_us = visual.offset_us;
+  calibration.audio_us = audible.offset_us - visual.offset_us;
+  return true;
 }
 
 void terminalHeroInit(void)
@@ -279,59 +952,44 @@ void terminalHeroInit(void)
   clock_gettime(CLOCK_MONOTONIC, &loopEndTime);
   clock_gettime(CLOCK_MONOTONIC, &beginningOfTime);
   clock_gettime(CLOCK_MONOTONIC, &nowTime);
-  clock_gettime(CLOCK_MONOTONIC, &frameStartTime);
 
-  // Beat = Quarter Note, 16th notes per update.  Full board is one measure
-  float divide_beat_per_update = 4.0f;
-  // update our ms_per_update now that we have the new BPM
-  ms_per_update = 1000.0f / ((BPM / 60.0f) * divide_beat_per_update);
+  // Beat = Quarter Note, 16th notes per update.  Full board is one measure,
+  // start scrolling from the top of the song's tempo map
+  scroller.reset();
 }
 
 void draw_board(void)
 {
-  attrset(COLOR_PAIR(7));
-  mvaddch(BOARD_START_Y - 1, BOARD_START_X, ACS_ULCORNER);
-  mvaddch(BOARD_START_Y - 1, BOARD_START_X + BOARD_WIDTH, ACS_URCORNER);
-  mvhline(BOARD_START_Y - 1, BOARD_START_X + 1, ACS_HLINE, BOARD_WIDTH - 1);
-  mvvline(BOARD_START_Y, BOARD_START_X, ACS_VLINE, BOARD_HEIGHT);
-  mvvline(BOARD_START_Y, BOARD_START_X + BOARD_WIDTH, ACS_VLINE, BOARD_HEIGHT);
-  mvhline(FINISH_LINE, BOARD_START_X + 1, ACS_HLINE, BOARD_WIDTH - 1);
-  mvaddch(FINISH_LINE, BOARD_START_X, ACS_LLCORNER);
-  mvaddch(FINISH_LINE, BOARD_START_X + BOARD_WIDTH, ACS_LRCORNER);
-
-  mvaddch(BOARD_START_Y - 1, NOTE_ONE_X, ERASE);
-  mvaddch(BOARD_START_Y - 1, NOTE_TWO_X, ERASE);
-  mvaddch(BOARD_START_Y - 1, NOTE_THREE_X, ERASE);
-  mvaddch(BOARD_START_Y - 1, NOTE_FOUR_X, ERASE);
-
-  attrset(COLOR_PAIR(2)); // GREEN
-  mvaddch(FINISH_LINE + 1, NOTE_ONE_X, 'A');
-  mvaddch(FINISH_LINE, NOTE_ONE_X, ACS_DIAMOND);
-
-  attrset(COLOR_PAIR(1)); // RED
-  mvaddch(FINISH_LINE + 1, NOTE_TWO_X, 'S');
-  mvaddch(FINISH_LINE, NOTE_TWO_X, ACS_DIAMOND);
-
-  attrset(COLOR_PAIR(3)); // YELLOW
-  mvaddch(FINISH_LINE + 1, NOTE_THREE_X, 'D');
-  mvaddch(FINISH_LINE, NOTE_THREE_X, ACS_DIAMOND);
-
-  attrset(COLOR_PAIR(4)); // BLUE
-  mvaddch(FINISH_LINE + 1, NOTE_FOUR_X, 'F');
-  mvaddch(FINISH_LINE, NOTE_FOUR_X, ACS_DIAMOND);
-
-
-  move(FINISH_LINE + 2, 0);
-
-  attrset(COLOR_PAIR(0)); // DEFAULT
-  printw("                           ____         ___\n");
-  printw("                         ,' __ ``.._..''   `.\n");
-  printw("                         `.`. ``-.___..-.    :\n");
-  printw(" ,---..____________________>/          _,'_  |\n");
-  printw(" `-:._,:_|_|_|_|_|_|_|_|_|_|_|.:SSt:.:|-|(/  |\n");
-  printw("                        _.' )   ____  '-'    ;\n");
-  printw("                       (    `-''  __``-'    /\n");
-  printw("                        ``-....-''  ``-..-''\n");
+  screen.put(BOARD_START_X, BOARD_START_Y - 1, GLYPH_ULCORNER, 7);
+  screen.put(BOARD_START_X + BOARD_WIDTH, BOARD_START_Y - 1, GLYPH_URCORNER, 7);
+  for (unsigned int x = BOARD_START_X + 1; x < BOARD_START_X + BOARD_WIDTH; x++) {
+    screen.put(x, BOARD_START_Y - 1, GLYPH_HLINE, 7);
+    screen.put(x, FINISH_LINE, GLYPH_HLINE, 7);
+  }
+  for (unsigned int y = BOARD_START_Y; y < BOARD_START_Y + BOARD_HEIGHT; y++) {
+    screen.put(BOARD_START_X, y, GLYPH_VLINE, 7);
+    screen.put(BOARD_START_X + BOARD_WIDTH, y, GLYPH_VLINE, 7);
+  }
+  screen.put(BOARD_START_X, FINISH_LINE, GLYPH_LLCORNER, 7);
+  screen.put(BOARD_START_X + BOARD_WIDTH, FINISH_LINE, GLYPH_LRCORNER, 7);
+
+  // every lane opens at the top, its key is under the finish line
+  for (unsigned int lane = 0; lane < CHART_LANES; lane++) {
+    unsigned int x = NOTE_ONE_X + 2 * lane;
+    screen.put(x, BOARD_START_Y - 1, ERASE, 7);
+    screen.put(x, FINISH_LINE + 1, toupper(LANE_KEYS[lane]), LANE_COLORS[lane]);
+    screen.put(x, FINISH_LINE, GLYPH_DIAMOND, LANE_COLORS[lane]);
+  }
+
+  unsigned int y = FINISH_LINE + 2;
+  screen.print(0, y++, 0, "                           ____         ___");
+  screen.print(0, y++, 0, "                         ,' __ ``.._..''   `.");
+  screen.print(0, y++, 0, "                         `.`. ``-.___..-.    :");
+  screen.print(0, y++, 0, " ,---..____________________>/          _,'_  |");
+  screen.print(0, y++, 0, " `-:._,:_|_|_|_|_|_|_|_|_|_|_|.:SSt:.:|-|(/  |");
+  screen.print(0, y++, 0, "                        _.' )   ____  '-'    ;");
+  screen.print(0, y++, 0, "                       (    `-''  __``-'    /");
+  screen.print(0, y++, 0, "                        ``-....-''  ``-..-''");
 }
 
 void cursesInit(void)
@@ -366,63 +1024,115 @@ void cursesInit(void)
   if (has_colors()) {
     start_color();
     // Notes: color pair 0 cannotbe redefined.
-    init_pair(1, COLOR_RED,     COLOR_BLACK);
-    init_pair(2, COLOR_GREEN,   COLOR_BLACK);
-    init_pair(3, COLOR_YELLOW,  COLOR_BLACK);
-    init_pair(4, COLOR_BLUE,    COLOR_BLACK);
-    init_pair(5, COLOR_CYAN,    COLOR_BLACK);
-    init_pair(6, COLOR_MAGENTA, COLOR_BLACK);
-    init_pair(7, COLOR_WHITE,   COLOR_BLACK);
+    for (short pair = 1; pair < COLOR_PAIRS_USED; pair++) init_pair(pair, PAIR_COLORS[pair], COLOR_BLACK);
   }
 }
 
-// Play a note on the synth.
-void playNote(fluid_synth_t* synth, int channel, int note, int velocity)
+// Raw mode and the same color pairs as cursesInit(), false if stdin is not
+// a terminal.
+bool ansiInit(void)
 {
-  /* Play a note */
-  fluid_synth_noteon(synth, channel, note, velocity);
-  /* Stop the note */
-  // fluid_synth_noteoff(synth, channel, note);
+  if (!ansi.begin(STDIN_FILENO, STDOUT_FILENO)) return false;
+  for (short pair = 1; pair < COLOR_PAIRS_USED; pair++) ansi.definePair(pair, PAIR_COLORS[pair], COLOR_BLACK);
+  return true;
+}
 
-  // increase scoreboard
-  score += BASE_SCORE_INCREMENT;
-  streak++;
+// Send the frame in the framebuffer to whichever backend is drawing.
+void presentScreen(void)
+{
+  if (useAnsi) {
+    screen.flush(ansi);
+    ansi.present();
+  } else {
+    screen.flush();
+    refresh();
+  }
+  if (firstFrame_us < 0) firstFrame_us = microsSince(processStart);
 }
 
-int spawnNote(void) {
-  int note = 0;
+// Count beats on the scoreboard at the song's opening tempo, then wait for
+// the sound font if it is still loading.  False if the player quit.
+bool countIn(int beats)
+{
+  const TempoMap& tempoMap = chart.tempoMap();
+  int64_t beat_us = tempoMap.isSmpte() ? 500000 : tempoMap.tempoAt(0);
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
 
-  int tracks = midifile.getTrackCount();
-  for (int track = 0; track < tracks; track++) {
-    for (int event = currEvent; event < midifile[track].size(); event++) {
-      if (now + 0.05 >= midifile[track][event].seconds * 1000) {
-        if (midifile[track][event].isNoteOn()) {
-          attrset(COLOR_PAIR(0)); // DEFAULT
-          if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 4, 0, "is Note On:\t%d       ", midifile[track][event].isNoteOn() );
-          // for (int i = 0; i < midifile[track][event].size(); i++)
-          if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 3, 0, "Midi Note On:\t%d       ", (int)midifile[track][event][midifile[track][event].size() - 2]);
-          if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 2, 0, "Midi Event at:\t%f   seconds", midifile[track][event].seconds);
-
-          currEvent = event + 1;
-          // if ( (int)midifile[track][event][midifile[track][event].size() - 2] > note) note = (int)midifile[track][event][midifile[track][event].size() - 2];
-          return (int)midifile[track][event][midifile[track][event].size() - 2];
-        }
-      } else if (now + 0.1 >= midifile[track][event].seconds * 1000) {
-        if (midifile[track][event].isNoteOn()) {
-          if (DEBUG) mvprintw(DEBUG_LINE_START_Y + 5, 0, "DBG:\t%f       ", midifile[track][event].seconds );
-        }
-      }
-      else {
-        return 0;
-      }
+  for (;;) {
+    int64_t elapsed = microsSince(start);
+    int64_t left = beats - elapsed / beat_us;
+    if (left <= 0 && soundFont.ready()) break;
+
+    if (left > 0) screen.print(BOARD_START_X, SCOREBOARD + 2, 7, "Get ready... %d       ", (int)left);
+    else screen.print(BOARD_START_X, SCOREBOARD + 2, 7, "Loading sounds...     ");
+    updateScoreboard();
+    presentScreen();
+
+    // a frame's time, or less if the next beat comes first
+    int64_t wait_us = left > 0 ? beat_us - elapsed % beat_us : us_per_frame;
+    if (wait_us > us_per_frame) wait_us = us_per_frame;
+    struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+    poll(&input, 1, (int)((wait_us + 999) / 1000));
+    int key;
+    while ((key = readKey()) != ERR) {
+      if (key == 'q') return false;
     }
   }
+  screen.print(BOARD_START_X, SCOREBOARD + 2, 7, "%-22s", "");
+  return true;
+}
+
+int64_t wallClock(void)
+{
+  return microsSince(beginningOfTime);
+}
+
+int64_t headlessClock(void)
+{
+  return simTime_us;
+}
+
+// Next key from whichever backend is drawing, ERR if there is none.
+int readKey(void)
+{
+  return useAnsi ? ansi.readKey() : getch();
+}
+
+// Play a note on the synth, through the audio thread when it is running.
+// Without it the note off is scheduled on clock, which the caller advances
+// directNoteOffs on.
+void playNote(fluid_synth_t* synth, int channel, int note, int velocity, int64_t press_us, int64_t duration_us,
+              GameClock clock)
+{
+  /* Play a note, the note off is scheduled duration_us later */
+  if (audio.running()) {
+    audio.noteOn(channel, note, velocity, press_us, duration_us);
+  } else if (synth) {
+    fluid_synth_noteon(synth, channel, note, velocity);
+    int64_t played_us = clock();
+    directNoteOnLatency.record(played_us - press_us);
+    directNoteOffs.noteOn(channel, note, played_us, duration_us);
+  }
 
-  return note;
+  // increase scoreboard
+  score += BASE_SCORE_INCREMENT;
+  streak++;
 }
 
 void updateScoreboard(void) {
-  attrset(COLOR_PAIR(7)); // DEFAULT
-  mvprintw(SCOREBOARD, BOARD_START_X, "Score: %d", score );
-  mvprintw(SCOREBOARD + 1, BOARD_START_X, "Streak: %d    ", streak );
+  static const char* names[JUDGE_COUNT] = { "Perfect", "Great", "Good", "Miss" };
+  // drawn every frame, the framebuffer only passes on what changed
+  screen.print(BOARD_START_X, SCOREBOARD, 7, "Score: %d", score );
+  screen.print(BOARD_START_X, SCOREBOARD + 1, 7, "Streak: %d    ", streak );
+
+  // last judgment next to the finish line, with how early or late it was
+  if (lastJudgment.grade == JUDGE_NONE) {
+    screen.print(JUDGEMENT_X, FINISH_LINE, 7, "%-20s", "");
+  } else {
+    screen.print(JUDGEMENT_X, FINISH_LINE, 7, "%-7s %+5d ms      ", names[lastJudgment.grade], (int)(lastJudgment.offset_us / 1000));
+  }
+  for (int grade = 0; grade < JUDGE_COUNT; grade++) {
+    screen.print(JUDGEMENT_X, FINISH_LINE - JUDGE_COUNT + grade, 7, "%-7s %5" PRIu64, names[grade], judge.count((Judgment)grade));
+  }
 }
\ No newline at end of file
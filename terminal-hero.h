@@ -13,13 +13,38 @@ midifile - midi file reader - https://github.com/craigsapp/midifile
 #include <fluidsynth.h>
 
 #include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
 #include <iostream>
 #include <time.h>
 #include <inttypes.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/resource.h>
 #include "MidiFile.h"
 #include "Options.h"
+#include "note-chart.h"
+#include "chart-cache.h"
+#include "chart-stream.h"
+#include "scroll-scheduler.h"
+#include "judge.h"
+#include "board.h"
+#include "lane-map.h"
+#include "song-library.h"
+#include "soundfont-load.h"
+#include "soundfont-presets.h"
+#include "audio-thread.h"
+#include "backing-track.h"
+#include "calibration.h"
+#include "offline-render.h"
+#include "framebuffer.h"
+#include "ansi-terminal.h"
+#include "parallel.h"
 #include <iostream>
 #include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
 
 using namespace std;
 using namespace smf;
@@ -27,57 +52,165 @@ using namespace smf;
 #define ERASE     ' '
 
 /* Constants */
-const unsigned int DRUM_CHANNEL = 9;
 const unsigned int MS_PER_FRAME = 150;
+// the simulation advances in fixed steps of this many microseconds
+const int64_t SIM_STEP_US = 1000;
 const unsigned int BOARD_START_X = 10;
 const unsigned int BOARD_START_Y = 4;
-const unsigned int BOARD_WIDTH = 8;
+const unsigned int BOARD_WIDTH = 2 * CHART_LANES;
 const unsigned int BOARD_HEIGHT = 16;
 const unsigned int FINISH_LINE = BOARD_START_Y + BOARD_HEIGHT;
 const unsigned int SCOREBOARD = FINISH_LINE + 3;
+const unsigned int JUDGEMENT_X = BOARD_START_X + BOARD_WIDTH + 3;
 
+// everything the game draws, the ASCII art included
+const unsigned int SCREEN_WIDTH = JUDGEMENT_X + 32;
+const unsigned int SCREEN_HEIGHT = FINISH_LINE + 10;
+
+// foreground of each color pair, all on black
+const short COLOR_PAIRS_USED = 8;
+const short PAIR_COLORS[COLOR_PAIRS_USED] = {
+  COLOR_WHITE, COLOR_RED, COLOR_GREEN, COLOR_YELLOW, COLOR_BLUE, COLOR_CYAN, COLOR_MAGENTA, COLOR_WHITE
+};
+
+// lane n is drawn at NOTE_ONE_X + 2 * n in LANE_COLORS[n] and played with
+// LANE_KEYS[n], or the nth arrow key for the first four lanes
 const unsigned int NOTE_ONE_X = BOARD_START_X + 1;
-const unsigned int NOTE_TWO_X = BOARD_START_X + 3;
-const unsigned int NOTE_THREE_X = BOARD_START_X + 5;
-const unsigned int NOTE_FOUR_X = BOARD_START_X + 7;
+const unsigned int MAX_LANES = 6;
+static_assert(CHART_LANES <= MAX_LANES, "every lane needs a key and a color");
+const char* const LANE_KEYS = "asdfgh";
+const short LANE_COLORS[MAX_LANES] = { 2, 1, 3, 4, 6, 5 };  // GREEN RED YELLOW BLUE MAGENTA CYAN
 
 const bool DEBUG = false;
 const unsigned int DEBUG_LINE_START_Y = FINISH_LINE + 10;
 
 const unsigned int BASE_SCORE_INCREMENT = 10;
 
+const char* const SOUND_FONT = "resources/sound-fonts/Masterpiece.sf2";
+
+// length of a hit note whose duration is not known yet
+const int64_t DEFAULT_NOTE_US = 250000;
+// longest a headless run waits for its last note offs once every note is judged
+const int64_t HEADLESS_RING_OUT_US = 60000000;
+
+// calibration metronome: a high wood block on the drum channel, the first
+// few beats are only there to find the rhythm
+const int CLICK_KEY = 76;
+const int64_t CLICK_INTERVAL_US = 600000;
+const int CLICK_LEAD_IN = 4;
+const int CLICK_TAPS = 16;
+const int64_t FLASH_US = 100000;
+
 /* Globals */
-int a_column[BOARD_HEIGHT] = { };
-int s_column[BOARD_HEIGHT] = { };
-int d_column[BOARD_HEIGHT] = { };
-int f_column[BOARD_HEIGHT] = { };
+// the falling notes, one lane per chart lane
+Board<CHART_LANES, BOARD_HEIGHT> board;
 
 // time
-uint64_t delta_us, now, frameStart;
-struct timespec beginningOfTime, nowTime, frameStartTime, loopStartTime, loopEndTime;
-
-// timing
-int BPM = 120;
-int currEvent = 0;
-float ms_per_update = 1000.0f / ((BPM / 60.0f) * 2.0f);
+uint64_t delta_us, now;
+int64_t now_us;
+struct timespec beginningOfTime, nowTime, loopStartTime, loopEndTime;
+
+// simulation and rendering clocks, in microseconds since beginningOfTime
+int64_t simTime_us = 0;
+int64_t nextFrame_us = 0;
+int64_t us_per_frame = 1000000 / 60;
+uint64_t simulationSteps = 0, simulationRows = 0, framesRendered = 0;
+
+// startup, in microseconds since main() began, -1 until it happens
+struct timespec processStart;
+int64_t firstFrame_us = -1;
+int64_t firstNote_us = -1;
+SoundFontLoad soundFont;
+
+// the board and scoreboard, drawn into cells and flushed as a diff
+Framebuffer screen(SCREEN_WIDTH, SCREEN_HEIGHT);
+LatencyStats frameTimes;  // time spent drawing and sending each frame
+
+// --ansi, raw escape sequences instead of curses
+AnsiTerminal ansi;
+bool useAnsi = false;
 
 // score
 int score = 0;
 int streak = 0;
 
-// midifile
-MidiFile midifile;
+// audio, the synth is driven from its own thread fed by a lock-free queue
+AudioThread audio;
+LatencyStats directNoteOnLatency;  // --direct-audio, measured in the input loop
+NoteOffScheduler directNoteOffs;   // --direct-audio, advanced by the main loop
+VoiceStats directVoices;
+LatencyStats inputPathLatency;     // key read to the input loop moving on
+int64_t renderLoad_us = 0;
+
+// the player's part, a bit per MIDI channel, everything else is backing
+uint16_t playerChannels = 0xFFFF & ~(1 << DRUM_CHANNEL);
+BackingTrack backing;
+
+// measured latencies, the board runs audio_us behind the game clock so it
+// lines up with what the player hears, and presses are judged input_us early
+Calibration calibration = { 0, 0 };
+
+// hit judgment, one queue per lane
+Judge judge(CHART_LANES);
+JudgeResult lastJudgment = { JUDGE_NONE, 0, 0, 0 };
+
+// midifile, joined with a k-way merge instead of the library's resort
+MergeJoinMidiFile midifile;
+
+// compact copy of every event in the song, the default loader
+EventStore events;
+
+// chart compiled from the midifile, and the next note to spawn
+NoteChart chart;
+size_t chartCursor = 0;
+// board row of the last note spawned in each lane, a row holds one note
+int64_t spawnRow[MAX_LANES] = { -1, -1, -1, -1, -1, -1 };
+bool useChartCache = true;
+
+// lanes for the chart's notes in every difficulty, and the one being played
+LaneMap laneMap;
+unsigned int difficulty = DIFFICULTY_HARD;
+
+// progressive loading, streaming is set until the whole file has arrived
+ChartStream chartStream;
+bool streaming = false;
+
+// one board row per 16th note, following the chart's tempo map
+ScrollScheduler scroller(chart.tempoMap());
 
 /* Funcion References */
-void playNote(fluid_synth_t* synth, int channel, int key, int velocity);
+// the clock notes are played on, microseconds since beginningOfTime: the
+// wall clock in a game, the simulation's virtual clock when headless
+typedef int64_t (*GameClock)(void);
+int64_t wallClock(void);
+int64_t headlessClock(void);
+void playNote(fluid_synth_t* synth, int channel, int key, int velocity, int64_t press_us, int64_t duration_us,
+              GameClock clock);
 void cursesInit(void);
+bool ansiInit(void);
+int readKey(void);
+void presentScreen(void);
+bool countIn(int beats);
 void terminalHeroInit(void);
-void update(void);
+void update(int64_t step_us);
+void render(int64_t render_us);
+void drawLane(unsigned int lane, unsigned int x, int color, int quarter);
 void draw_board(void);
-void make_it_rain(void);
+void make_it_rain(int64_t step_us);
+void spawnInLane(unsigned int lane, int note, size_t index);
+int laneForKey(int key);
+void hitLane(fluid_synth_t* synth, int channel, unsigned int lane, int64_t press_us, int velocity, GameClock clock);
 
-int spawnNote(void);
 void updateScoreboard(void);
+int waitForInputOrUpdate(void);
+void printCpuUsage(void);
+bool printLoadBenchmark(const string& songBytes, uint64_t songHash, int threads);
+bool checkJoin(const string& songBytes);
+bool renderSong(const string& songBytes, const string& wavFile, int workers);
+bool printLibrary(const string& root, int threads);
+bool runHeadless(fluid_synth_t* synth, int channel, const string& script);
+bool collectTaps(fluid_synth_t* synth, bool audible, std::vector<int64_t>& offsets);
+bool runCalibration(fluid_synth_t* synth, TapEstimate& visual, TapEstimate& audible);
 
 /*---------------------------\
 | GENERAL MIDI SPECIFICATION |
@@ -0,0 +1,140 @@
+/* timer-wheel.cpp
+
+Hierarchical timer wheel, after the classic kernel timer design.
+*/
+#include "timer-wheel.h"
+
+TimerWheel::TimerWheel(int64_t tick_us)
+  : m_tick_us(tick_us > 0 ? tick_us : 1), m_serial(0)
+{
+  reset(0);
+}
+
+void TimerWheel::reset(int64_t now_us)
+{
+  m_now = now_us / m_tick_us;
+  m_pending = 0;
+  m_timers.clear();
+  m_free = NIL;
+  for (int level = 0; level < LEVELS; level++) {
+    for (int slot = 0; slot < SLOTS; slot++) m_slots[level][slot] = NIL;
+  }
+}
+
+// Link a timer into the finest level whose range covers it.
+void TimerWheel::insert(int32_t timer)
+{
+  int64_t tick = m_timers[timer].tick;
+  int64_t distance = tick - m_now;
+  int32_t* slot;
+  if (distance < 0) {
+    // already due, fire on the next tick processed
+    slot = &m_slots[0][m_now & SLOT_MASK];
+  } else {
+    int level = 0;
+    while (level < LEVELS - 1 && distance >= ((int64_t)1 << (SLOT_BITS * (level + 1)))) level++;
+    slot = &m_slots[level][(tick >> (SLOT_BITS * level)) & SLOT_MASK];
+  }
+  m_timers[timer].next = *slot;
+  *slot = timer;
+}
+
+uint64_t TimerWheel::schedule(int64_t when_us, uint32_t payload)
+{
+  int64_t tick = (when_us + m_tick_us - 1) / m_tick_us;
+  int64_t furthest = m_now + ((int64_t)1 << (SLOT_BITS * LEVELS)) - 1;
+  if (tick > furthest) tick = furthest;
+
+  int32_t timer;
+  if (m_free != NIL) {
+    timer = m_free;
+    m_free = m_timers[timer].next;
+  } else {
+    timer = (int32_t)m_timers.size();
+    m_timers.push_back(Timer());
+  }
+  if (++m_serial == 0) m_serial = 1;
+  m_timers[timer].tick = tick;
+  m_timers[timer].payload = payload;
+  m_timers[timer].serial = m_serial;
+  m_timers[timer].cancelled = false;
+  insert(timer);
+  m_pending++;
+  return (uint64_t)m_serial << 32 | (uint32_t)timer;
+}
+
+bool TimerWheel::cancel(uint64_t id)
+{
+  uint32_t timer = (uint32_t)id;
+  if (timer >= m_timers.size() || m_timers[timer].serial != (uint32_t)(id >> 32) || m_timers[timer].cancelled) return false;
+  // unlinking would need the list it is on, it is skipped when it comes up
+  m_timers[timer].cancelled = true;
+  m_pending--;
+  return true;
+}
+
+// Spread the current slot of level out over the finer levels.  Returns true
+// if that slot index is 0, meaning the next level up has wrapped as well.
+bool TimerWheel::cascade(int level)
+{
+  int64_t index = (m_now >> (SLOT_BITS * level)) & SLOT_MASK;
+  int32_t timer = m_slots[level][index];
+  m_slots[level][index] = NIL;
+  while (timer != NIL) {
+    int32_t next = m_timers[timer].next;
+    insert(timer);
+    timer = next;
+  }
+  return index == 0;
+}
+
+size_t TimerWheel::advance(int64_t now_us, std::vector<uint32_t>& expired)
+{
+  size_t fired = 0;
+  int64_t target = now_us / m_tick_us;
+  while (m_now <= target) {
+    int64_t index = m_now & SLOT_MASK;
+    if (index == 0) {
+      for (int level = 1; level < LEVELS && cascade(level); level++) { }
+    }
+
+    // sort the slot by serial so equal deadlines fire in the order they were
+    // scheduled.  The list is newest first, so each timer usually goes to the
+    // front; only timers cascaded in after ones scheduled straight into the
+    // slot have to walk.
+    int32_t timer = m_slots[0][index], sorted = NIL;
+    m_slots[0][index] = NIL;
+    while (timer != NIL) {
+      int32_t next = m_timers[timer].next;
+      int32_t* link = &sorted;
+      while (*link != NIL && (int32_t)(m_timers[*link].serial - m_timers[timer].serial) < 0) link = &m_timers[*link].next;
+      m_timers[timer].next = *link;
+      *link = timer;
+      timer = next;
+    }
+    for (timer = sorted; timer != NIL;) {
+      int32_t next = m_timers[timer].next;
+      if (!m_timers[timer].cancelled) {
+        expired.push_back(m_timers[timer].payload);
+        m_pending--;
+        fired++;
+      }
+      m_timers[timer].serial = 0;
+      m_timers[timer].next = m_free;
+      m_free = timer;
+      timer = next;
+    }
+    m_now++;
+  }
+  return fired;
+}
+
+int64_t TimerWheel::nextDeadline(void) const
+{
+  if (!m_pending) return -1;
+  for (int64_t tick = m_now; tick < m_now + SLOTS; tick++) {
+    // slot 0 is also where the coarser levels get spread out
+    if (m_slots[0][tick & SLOT_MASK] != NIL || (tick & SLOT_MASK) == 0) return tick * m_tick_us;
+  }
+  return (m_now + SLOTS) * m_tick_us;
+}
@@ -0,0 +1,74 @@
+/* timer-wheel.h
+
+Hierarchical timer wheel.  Four levels of 64 slots; level 0 slots are one
+tick wide, every level above is 64 times coarser.  A timer goes into the
+finest level that can hold it, and the slots of a coarser level are spread
+back down one level each time the finer level wraps around.  Scheduling and
+expiring are O(1) however many timers are pending.
+
+Timers are nodes in one pool linked through indices, so once the pool has
+grown to the peak number of pending timers nothing is allocated.  A cancelled
+timer stays linked, marked, until its slot comes round and it is freed.
+*/
+
+#ifndef _TIMER_WHEEL_H_INCLUDED
+#define _TIMER_WHEEL_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class TimerWheel {
+  public:
+    explicit TimerWheel(int64_t tick_us = 1000);
+
+    // Drop every timer and start counting from now_us.
+    void reset(int64_t now_us);
+
+    // Fire payload once the wheel has been advanced past when_us.  Times
+    // further out than the wheel reaches (about 4.6 hours at 1 ms ticks)
+    // fire at the end of its range.  Returns an id for cancel(), never 0.
+    uint64_t schedule(int64_t when_us, uint32_t payload);
+
+    // Keep a timer from firing.  False if it already fired or was cancelled.
+    bool cancel(uint64_t id);
+
+    // Move the wheel up to now_us, appending the payload of every timer that
+    // expired to expired in expiry order.  Returns how many did.
+    size_t advance(int64_t now_us, std::vector<uint32_t>& expired);
+
+    size_t pending(void) const { return m_pending; }
+
+    // Earliest time the wheel needs advancing for something to happen, or -1
+    // if nothing is pending.  May be early, when a coarse slot only needs
+    // spreading out, but never late.
+    int64_t nextDeadline(void) const;
+
+  private:
+    static const int LEVELS = 4;
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int64_t SLOT_MASK = SLOTS - 1;
+    static const int32_t NIL = -1;
+
+    struct Timer {
+      int64_t  tick;
+      uint32_t payload;
+      uint32_t serial;  // high half of the timer's id, 0 once it is freed
+      int32_t  next;
+      bool     cancelled;
+    };
+
+    void insert(int32_t timer);
+    bool cascade(int level);
+
+    int64_t            m_tick_us;
+    int64_t            m_now;     // next tick to process
+    size_t             m_pending;
+    std::vector<Timer> m_timers;
+    int32_t            m_free;
+    uint32_t           m_serial;  // of the last timer scheduled
+    int32_t            m_slots[LEVELS][SLOTS];
+};
+
+#endif /* _TIMER_WHEEL_H_INCLUDED */